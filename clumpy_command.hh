@@ -1,5 +1,8 @@
 #pragma once
 
+#include "fmt/core.h"
+
+#include <algorithm>
 #include <functional>
 #include <string>
 #include <unordered_map>
@@ -14,6 +17,35 @@ struct ClumpyCommand {
     virtual std::string example() const = 0;
     virtual bool exec(std::vector<std::string> args) = 0;
 
+    // Optional arguments have the form "name=value" and can appear anywhere in the argument list.
+    // This removes them from the list and returns them in a map.
+    using Options = std::unordered_map<std::string, std::string>;
+    static Options extract_options(std::vector<std::string>& args) {
+        Options options;
+        std::vector<std::string> positional;
+        for (auto const& arg : args) {
+            auto eq = arg.find('=');
+            if (eq == std::string::npos || eq == 0) {
+                positional.push_back(arg);
+            } else {
+                options[arg.substr(0, eq)] = arg.substr(eq + 1);
+            }
+        }
+        args.swap(positional);
+        return options;
+    }
+
+    // Returns false and prints the offending name if an option is not in the list of known names.
+    static bool check_options(Options const& options, std::vector<std::string> known) {
+        for (auto const& option : options) {
+            if (std::find(known.begin(), known.end(), option.first) == known.end()) {
+                fmt::print("Unknown option: {}\n", option.first);
+                return false;
+            }
+        }
+        return true;
+    }
+
     using FactoryFn = std::function<ClumpyCommand*()>;
 
     using Registry = std::unordered_map<std::string, FactoryFn>;
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <thread>
+#include <vector>
+
+// Invokes fn(begin, end) on contiguous chunks of [0, count) using all hardware threads. Chunks are
+// handed out on demand, which balances uneven workloads. Runs inline if there is only one chunk.
+inline void parallel_for(uint32_t count, uint32_t chunk_size,
+        std::function<void(uint32_t, uint32_t)> fn) {
+    chunk_size = std::max(chunk_size, 1u);
+    const uint32_t nchunks = (count + chunk_size - 1) / chunk_size;
+    const uint32_t nthreads = std::min(nchunks, std::max(1u, std::thread::hardware_concurrency()));
+    if (nthreads <= 1) {
+        if (count > 0) fn(0, count);
+        return;
+    }
+    std::atomic<uint32_t> next_chunk(0);
+    auto worker = [&] {
+        uint32_t chunk;
+        while ((chunk = next_chunk++) < nchunks) {
+            const uint32_t begin = chunk * chunk_size;
+            fn(begin, std::min(count, begin + chunk_size));
+        }
+    };
+    std::vector<std::thread> threads;
+    for (uint32_t i = 1; i < nthreads; ++i) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
@@ -15,6 +15,8 @@ using std::string;
 void splat_points(vec2 const* ptlist, uint32_t npts, u32vec2 size, uint8_t* dstimg);
 void splat_disks(vec2 const* ptlist, uint32_t npts, u32vec2 dims, uint8_t* dstimg, float alpha,
         int kernel_size);
+void splat_disks_supersampled(vec2 const* ptlist, uint32_t npts, u32vec2 dims, uint8_t* dstimg,
+        float alpha, int kernel_size, int factor);
 
 extern bool advect_wrapx;
 
@@ -50,10 +52,10 @@ struct AdvectPoints : ClumpyCommand {
     }
     string usage() const override {
         return "<input_pts> <velocities_img> <step_size> <kernel_size> <decay> <nframes> "
-                "<suffix_img>";
+                "<suffix_img> [supersample=1]";
     }
     string example() const override {
-        return "coords.npy speeds.npy 1.0 3 0.5 240 anim.npy";
+        return "coords.npy speeds.npy 1.0 3 0.5 240 anim.npy supersample=2";
     }
 };
 
@@ -62,6 +64,10 @@ static ClumpyCommand::Register registrar("advect_points", [] {
 });
 
 bool AdvectPoints::exec(vector<string> vargs) {
+    const Options options = extract_options(vargs);
+    if (!check_options(options, {"supersample"})) {
+        return false;
+    }
     if (vargs.size() != 7) {
         fmt::print("This command takes 7 arguments.\n");
         return false;
@@ -74,6 +80,13 @@ bool AdvectPoints::exec(vector<string> vargs) {
     float decay = atof(vargs[4].c_str());
     const uint32_t nframes = atoi(vargs[5].c_str());
     const string suffix = vargs[6];
+    const int supersample = options.count("supersample") ?
+            atoi(options.at("supersample").c_str()) : 1;
+
+    if (supersample < 1 || supersample > 16) {
+        fmt::print("Supersample factor must be an integer in [1,16].\n");
+        return false;
+    }
 
     if (decay < 0) {
         advect_wrapx = true;
@@ -103,8 +116,8 @@ bool AdvectPoints::exec(vector<string> vargs) {
         return false;
     }
     Image velocities {
-        .width = (uint32_t) img.shape[1],
         .height = (uint32_t) img.shape[0],
+        .width = (uint32_t) img.shape[1],
         .pixels = img.data<vec2>()
     };
 
@@ -120,6 +133,18 @@ bool AdvectPoints::exec(vector<string> vargs) {
 
     const u32vec2 dims(velocities.width, velocities.height);
 
+    // When supersampling, the sprites are drawn at a higher resolution and filtered down into
+    // dstimg, while the fading trails stay at the output resolution.
+    auto splat = [&](vec2 const* pts, uint32_t count) {
+        const float alpha = 1.0f;
+        if (supersample > 1) {
+            splat_disks_supersampled(pts, count, dims, dstimg.data(), alpha, kernel_size,
+                    supersample);
+        } else {
+            splat_disks(pts, count, dims, dstimg.data(), alpha, kernel_size);
+        }
+    };
+
     const uint32_t npts = original_points.count;
     vector<float> particle_age(npts);
     vector<vec2> advected_points(original_points.coords, original_points.coords + npts);
@@ -153,8 +178,7 @@ bool AdvectPoints::exec(vector<string> vargs) {
             }
             if (decay != 0) {
                 for (auto& v: dstimg) v *= decay;
-                const float alpha = 1.0f;
-                splat_disks(advected_points.data(), npts, dims, dstimg.data(), alpha, kernel_size);
+                splat(advected_points.data(), npts);
             }
             continue;
         }
@@ -172,8 +196,7 @@ bool AdvectPoints::exec(vector<string> vargs) {
 
         // Render image and write to disk.
         for (auto& v: dstimg) v *= decay;
-        const float alpha = 1.0f;
-        splat_disks(advected_points.data(), npts, dims, dstimg.data(), alpha, kernel_size);
+        splat(advected_points.data(), npts);
         const string filename = fmt::format("{:03}{}", animframe++, suffix);
         cnpy::npy_save(filename, dstimg.data(), {dims.y, dims.x}, "w");
     }
@@ -0,0 +1,97 @@
+#include "clumpy_command.hh"
+#include "fmt/core.h"
+
+#include <glm/vec2.hpp>
+#include <glm/ext.hpp>
+
+#include <chrono>
+#include <limits>
+#include <random>
+
+using namespace glm;
+
+using std::vector;
+using std::string;
+
+void splat_disks(vec2 const* ptlist, uint32_t npts, u32vec2 dims, uint8_t* dstimg, float alpha,
+        int kernel_size);
+void splat_disks_reference(vec2 const* ptlist, uint32_t npts, u32vec2 dims, uint8_t* dstimg,
+        float alpha, int kernel_size);
+
+namespace {
+
+struct BenchSplat : ClumpyCommand {
+    BenchSplat() {}
+    bool exec(vector<string> args) override;
+    string description() const override {
+        return "compare specialized sprite kernels against the original splat loop";
+    }
+    string usage() const override {
+        return "<dims> <npts> <niterations>";
+    }
+    string example() const override {
+        return "2000x2000 1000000 5";
+    }
+};
+
+static ClumpyCommand::Register registrar("bench_splat", [] {
+    return new BenchSplat();
+});
+
+using SplatFn = void (*)(vec2 const*, uint32_t, u32vec2, uint8_t*, float, int);
+
+// Returns the best time in nanoseconds per point over several iterations.
+double time_splats(SplatFn fn, vector<vec2> const& pts, u32vec2 dims, int kernel_size,
+        int niterations, vector<uint8_t>& dstimg) {
+    using clock = std::chrono::high_resolution_clock;
+    double best = std::numeric_limits<double>::max();
+    for (int i = 0; i < niterations; ++i) {
+        std::fill(dstimg.begin(), dstimg.end(), 0);
+        auto start = clock::now();
+        fn(pts.data(), pts.size(), dims, dstimg.data(), 0.5f, kernel_size);
+        std::chrono::duration<double, std::nano> elapsed = clock::now() - start;
+        best = std::min(best, elapsed.count() / pts.size());
+    }
+    return best;
+}
+
+bool BenchSplat::exec(vector<string> vargs) {
+    if (vargs.size() != 3) {
+        fmt::print("This command takes 3 arguments.\n");
+        return false;
+    }
+    const string dims = vargs[0];
+    const uint32_t width = atoi(dims.c_str());
+    const uint32_t height = atoi(dims.substr(dims.find('x') + 1).c_str());
+    const uint32_t npts = atoi(vargs[1].c_str());
+    const int niterations = std::max(1, atoi(vargs[2].c_str()));
+    const u32vec2 size(width, height);
+
+    std::mt19937 generator(0);
+    std::uniform_real_distribution<float> x_rand(0, width);
+    std::uniform_real_distribution<float> y_rand(0, height);
+    vector<vec2> pts(npts);
+    for (auto& pt : pts) {
+        pt = vec2(x_rand(generator), y_rand(generator));
+    }
+
+    vector<uint8_t> reference_img(width * height);
+    vector<uint8_t> specialized_img(width * height);
+
+    fmt::print("{:>6} {:>14} {:>14} {:>8}\n", "kernel", "original ns/pt", "special ns/pt", "speedup");
+    for (int kernel_size : {1, 3, 5, 7, 9}) {
+        double reference = time_splats(splat_disks_reference, pts, size, kernel_size, niterations,
+                reference_img);
+        double specialized = time_splats(splat_disks, pts, size, kernel_size, niterations,
+                specialized_img);
+        if (reference_img != specialized_img) {
+            fmt::print("Kernel size {} produced mismatched images.\n", kernel_size);
+            return false;
+        }
+        fmt::print("{:>6} {:>14.2f} {:>14.2f} {:>7.2f}x\n", kernel_size, reference, specialized,
+                reference / specialized);
+    }
+    return true;
+}
+
+} // anonymous namespace
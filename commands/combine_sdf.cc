@@ -0,0 +1,496 @@
+#include "clumpy_command.hh"
+#include "clumpy_parallel.hh"
+#include "fmt/core.h"
+#include "cnpy/cnpy.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define CLUMPY_COMBINE_AVX2 1
+#endif
+
+using std::vector;
+using std::string;
+using std::numeric_limits;
+
+namespace {
+
+struct CombineSdf : ClumpyCommand {
+    CombineSdf() {}
+    bool exec(vector<string> args) override;
+    string description() const override {
+        return "combine signed distance fields with min, max, negate and smooth min";
+    }
+    string usage() const override {
+        return "<expression> <output_img> <input_img> ...";
+    }
+    string example() const override {
+        return "'smin(a, max(b, -c), 0.05)' out.npy a.npy b.npy c.npy";
+    }
+};
+
+static ClumpyCommand::Register registrar("combine_sdf", [] {
+    return new CombineSdf();
+});
+
+// Pixels are processed in blocks small enough for the whole evaluation stack to stay in L1, and
+// blocks are grouped into larger chunks for the thread pool.
+constexpr uint32_t BlockSize = 256;
+constexpr uint32_t ChunkSize = 64 * 1024;
+
+enum Opcode { Input, Constant, Negate, Minimum, Maximum, SmoothMinimum };
+
+struct Instruction {
+    Opcode op;
+    uint32_t input;
+    float value;
+};
+
+// Compiles an expression into a postfix program. Inputs are single letters, where a is the first
+// input file, b is the second, and so on. Functions are min(x, y, ...), max(x, y, ...) and
+// smin(x, y, radius), where the radius is a positive number. A leading minus sign negates.
+struct Parser {
+    string text;
+    size_t pos = 0;
+    uint32_t ninputs;
+    vector<Instruction> program;
+    string error;
+
+    bool parse();
+private:
+    bool expression();
+    bool number(float* value);
+    bool expect(char c);
+    bool fail(string const& message);
+    void skip_space() { while (pos < text.size() && isspace(text[pos])) ++pos; }
+};
+
+bool Parser::parse() {
+    if (!expression()) return false;
+    skip_space();
+    return pos == text.size() || fail("Unexpected trailing characters");
+}
+
+bool Parser::fail(string const& message) {
+    if (error.empty()) {
+        error = fmt::format("{} at position {} of expression.", message, pos);
+    }
+    return false;
+}
+
+bool Parser::expect(char c) {
+    skip_space();
+    if (pos < text.size() && text[pos] == c) {
+        ++pos;
+        return true;
+    }
+    return fail(fmt::format("Expected '{}'", c));
+}
+
+bool Parser::number(float* value) {
+    skip_space();
+    char const* begin = text.c_str() + pos;
+    char* end;
+    *value = strtof(begin, &end);
+    if (end == begin) return fail("Expected a number");
+    pos += end - begin;
+    return true;
+}
+
+bool Parser::expression() {
+    skip_space();
+    if (pos == text.size()) return fail("Unexpected end");
+    const char c = text[pos];
+    if (c == '-' && !(pos + 1 < text.size() && (isdigit(text[pos + 1]) || text[pos + 1] == '.'))) {
+        ++pos;
+        if (!expression()) return false;
+        program.push_back({Negate, 0, 0});
+        return true;
+    }
+    if (isdigit(c) || c == '-' || c == '.') {
+        float value;
+        if (!number(&value)) return false;
+        program.push_back({Constant, 0, value});
+        return true;
+    }
+    if (!islower(c)) return fail("Unexpected character");
+
+    const size_t start = pos;
+    while (pos < text.size() && islower(text[pos])) ++pos;
+    const string name = text.substr(start, pos - start);
+    if (name.size() == 1) {
+        const uint32_t input = name[0] - 'a';
+        if (input >= ninputs) return fail(fmt::format("No input file for '{}'", name));
+        program.push_back({Input, input, 0});
+        return true;
+    }
+    if (name != "min" && name != "max" && name != "smin") {
+        pos = start;
+        return fail(fmt::format("Unknown function '{}'", name));
+    }
+    if (!expect('(') || !expression() || !expect(',') || !expression()) return false;
+    if (name == "smin") {
+        float radius;
+        if (!expect(',') || !number(&radius)) return false;
+        if (!(radius > 0)) return fail("Smooth min radius must be positive");
+        program.push_back({SmoothMinimum, 0, radius});
+        return expect(')');
+    }
+    const Opcode op = name == "min" ? Minimum : Maximum;
+    program.push_back({op, 0, 0});
+    skip_space();
+    while (pos < text.size() && text[pos] == ',') {
+        ++pos;
+        if (!expression()) return false;
+        program.push_back({op, 0, 0});
+        skip_space();
+    }
+    return expect(')');
+}
+
+// Returns the number of stack slots that the program needs.
+uint32_t stack_depth(vector<Instruction> const& program) {
+    uint32_t depth = 0, max_depth = 0;
+    for (auto const& instr : program) {
+        if (instr.op == Input || instr.op == Constant) {
+            max_depth = std::max(max_depth, ++depth);
+        } else if (instr.op != Negate) {
+            --depth;
+        }
+    }
+    return max_depth;
+}
+
+// These match the AVX2 instructions, which return the second operand when the two are equal, so
+// that the tail of each block agrees exactly with the vector path.
+float min1(float a, float b) { return a < b ? a : b; }
+float max1(float a, float b) { return a > b ? a : b; }
+
+// Polynomial smooth minimum, which blends a and b where they are within the radius of each other.
+float smooth_min(float a, float b, float radius) {
+    const float h = max1(radius - std::abs(a - b), 0.0f);
+    return min1(a, b) - h * h * (0.25f / radius);
+}
+
+// Runs the program over count pixels starting at offset. Each stack slot is a pointer to count
+// values, which either points directly into an input or into the slot's scratch buffer, so inputs
+// are never copied. Returns a pointer to the result.
+using ExecuteFn = float const* (*)(vector<Instruction> const&, vector<float const*> const&,
+        uint32_t offset, uint32_t count, float* scratch, float const** stack);
+
+float const* execute_scalar(vector<Instruction> const& program, vector<float const*> const& inputs,
+        uint32_t offset, uint32_t count, float* scratch, float const** stack) {
+    uint32_t depth = 0;
+    for (auto const& instr : program) {
+        if (instr.op == Input) {
+            stack[depth++] = inputs[instr.input] + offset;
+            continue;
+        }
+        if (instr.op == Constant) {
+            float* dst = scratch + depth * BlockSize;
+            std::fill(dst, dst + count, instr.value);
+            stack[depth++] = dst;
+            continue;
+        }
+        if (instr.op == Negate) {
+            float const* x = stack[depth - 1];
+            float* dst = scratch + (depth - 1) * BlockSize;
+            for (uint32_t i = 0; i < count; ++i) dst[i] = -x[i];
+            stack[depth - 1] = dst;
+            continue;
+        }
+        float const* x = stack[depth - 2];
+        float const* y = stack[depth - 1];
+        float* dst = scratch + (depth - 2) * BlockSize;
+        switch (instr.op) {
+            case Minimum:
+                for (uint32_t i = 0; i < count; ++i) dst[i] = min1(x[i], y[i]);
+                break;
+            case Maximum:
+                for (uint32_t i = 0; i < count; ++i) dst[i] = max1(x[i], y[i]);
+                break;
+            default:
+                for (uint32_t i = 0; i < count; ++i) dst[i] = smooth_min(x[i], y[i], instr.value);
+                break;
+        }
+        stack[--depth - 1] = dst;
+    }
+    return stack[0];
+}
+
+#ifdef CLUMPY_COMBINE_AVX2
+
+// Same as execute_scalar, eight pixels at a time. Any pixels beyond the last multiple of eight are
+// left to the scalar path.
+__attribute__((target("avx2")))
+float const* execute_avx2(vector<Instruction> const& program, vector<float const*> const& inputs,
+        uint32_t offset, uint32_t count, float* scratch, float const** stack) {
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    uint32_t depth = 0;
+    for (auto const& instr : program) {
+        if (instr.op == Input) {
+            stack[depth++] = inputs[instr.input] + offset;
+            continue;
+        }
+        if (instr.op == Constant) {
+            float* dst = scratch + depth * BlockSize;
+            const __m256 value = _mm256_set1_ps(instr.value);
+            for (uint32_t i = 0; i < count; i += 8) _mm256_storeu_ps(dst + i, value);
+            stack[depth++] = dst;
+            continue;
+        }
+        if (instr.op == Negate) {
+            float const* x = stack[depth - 1];
+            float* dst = scratch + (depth - 1) * BlockSize;
+            for (uint32_t i = 0; i < count; i += 8) {
+                _mm256_storeu_ps(dst + i, _mm256_xor_ps(_mm256_loadu_ps(x + i), sign));
+            }
+            stack[depth - 1] = dst;
+            continue;
+        }
+        float const* x = stack[depth - 2];
+        float const* y = stack[depth - 1];
+        float* dst = scratch + (depth - 2) * BlockSize;
+        switch (instr.op) {
+            case Minimum:
+                for (uint32_t i = 0; i < count; i += 8) {
+                    _mm256_storeu_ps(dst + i,
+                            _mm256_min_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i)));
+                }
+                break;
+            case Maximum:
+                for (uint32_t i = 0; i < count; i += 8) {
+                    _mm256_storeu_ps(dst + i,
+                            _mm256_max_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i)));
+                }
+                break;
+            default: {
+                const __m256 radius = _mm256_set1_ps(instr.value);
+                const __m256 scale = _mm256_set1_ps(0.25f / instr.value);
+                const __m256 zero = _mm256_setzero_ps();
+                for (uint32_t i = 0; i < count; i += 8) {
+                    const __m256 a = _mm256_loadu_ps(x + i);
+                    const __m256 b = _mm256_loadu_ps(y + i);
+                    const __m256 diff = _mm256_andnot_ps(sign, _mm256_sub_ps(a, b));
+                    const __m256 h = _mm256_max_ps(_mm256_sub_ps(radius, diff), zero);
+                    _mm256_storeu_ps(dst + i, _mm256_sub_ps(_mm256_min_ps(a, b),
+                            _mm256_mul_ps(_mm256_mul_ps(h, h), scale)));
+                }
+                break;
+            }
+        }
+        stack[--depth - 1] = dst;
+    }
+    return stack[0];
+}
+
+#endif
+
+ExecuteFn select_execute() {
+#ifdef CLUMPY_COMBINE_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return execute_avx2;
+    }
+#endif
+    return execute_scalar;
+}
+
+const ExecuteFn execute_fn = select_execute();
+
+// A float32 npy file mapped into memory. The header is parsed with cnpy and the data follows it.
+struct MappedArray {
+    vector<size_t> shape;
+    size_t count = 0;
+    float* data = nullptr;
+    void* base = MAP_FAILED;
+    size_t size = 0;
+
+    MappedArray() {}
+    MappedArray(MappedArray const&) = delete;
+    bool open(string const& filename, bool writable);
+    bool create(string const& filename, vector<size_t> const& shape);
+    ~MappedArray();
+private:
+    bool map(int fd, bool writable, size_t offset);
+};
+
+bool MappedArray::map(int fd, bool writable, size_t offset) {
+    const int prot = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+    base = mmap(nullptr, size, prot, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (base == MAP_FAILED) return false;
+    data = reinterpret_cast<float*>(static_cast<char*>(base) + offset);
+    return true;
+}
+
+bool MappedArray::open(string const& filename, bool writable) {
+    FILE* fp = fopen(filename.c_str(), "rb");
+    if (!fp) {
+        fmt::print("Unable to open {}.\n", filename);
+        return false;
+    }
+    size_t word_size;
+    char type_code;
+    bool fortran_order;
+    cnpy::parse_npy_header(fp, word_size, type_code, shape, fortran_order);
+    const size_t offset = ftell(fp);
+    fclose(fp);
+    if (word_size != sizeof(float) || type_code != 'f' || fortran_order) {
+        fmt::print("{} must be a C-ordered float32 array.\n", filename);
+        return false;
+    }
+    count = 1;
+    for (size_t dim : shape) count *= dim;
+    size = offset + count * sizeof(float);
+
+    const int fd = ::open(filename.c_str(), writable ? O_RDWR : O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0 || size_t(info.st_size) < size) {
+        if (fd >= 0) ::close(fd);
+        fmt::print("{} is truncated.\n", filename);
+        return false;
+    }
+    if (!map(fd, writable, offset)) {
+        fmt::print("Unable to map {}.\n", filename);
+        return false;
+    }
+    return true;
+}
+
+// Writes an npy header and extends the file to its full size, then maps the data for writing.
+bool MappedArray::create(string const& filename, vector<size_t> const& dims) {
+    shape = dims;
+    count = 1;
+    for (size_t dim : shape) count *= dim;
+    const vector<char> header = cnpy::create_npy_header<float>(shape);
+    size = header.size() + count * sizeof(float);
+    const int fd = ::open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || write(fd, header.data(), header.size()) != ssize_t(header.size()) ||
+            ftruncate(fd, size) != 0) {
+        if (fd >= 0) ::close(fd);
+        fmt::print("Unable to create {}.\n", filename);
+        return false;
+    }
+    if (!map(fd, true, header.size())) {
+        fmt::print("Unable to map {}.\n", filename);
+        return false;
+    }
+    return true;
+}
+
+MappedArray::~MappedArray() {
+    if (base != MAP_FAILED) munmap(base, size);
+}
+
+bool same_file(string const& a, string const& b) {
+    struct stat sa, sb;
+    return stat(a.c_str(), &sa) == 0 && stat(b.c_str(), &sb) == 0 && sa.st_dev == sb.st_dev &&
+            sa.st_ino == sb.st_ino;
+}
+
+// Evaluates the expression at every pixel in a single pass, with the inputs and the output mapped
+// into memory rather than loaded, and no intermediate images. The inputs must all have the same
+// shape. The output may be the same file as the first input, in which case it is overwritten in
+// place.
+//
+// Distances are combined as-is, so the smooth min radius is in the units of the inputs.
+bool CombineSdf::exec(vector<string> vargs) {
+    if (vargs.size() < 3) {
+        fmt::print("This command takes at least 3 arguments.\n");
+        return false;
+    }
+    const string output_file = vargs[1];
+    const vector<string> input_files(vargs.begin() + 2, vargs.end());
+    if (input_files.size() > 26) {
+        fmt::print("At most 26 inputs are supported.\n");
+        return false;
+    }
+
+    Parser parser;
+    parser.text = vargs[0];
+    parser.ninputs = input_files.size();
+    if (!parser.parse()) {
+        fmt::print("{}\n", parser.error);
+        return false;
+    }
+    const vector<Instruction> program = parser.program;
+    const uint32_t depth = stack_depth(program);
+
+    const bool in_place = same_file(output_file, input_files[0]);
+    for (size_t i = 1; i < input_files.size(); ++i) {
+        if (same_file(output_file, input_files[i])) {
+            fmt::print("Only the first input can be overwritten.\n");
+            return false;
+        }
+    }
+
+    vector<MappedArray> inputs(input_files.size());
+    vector<float const*> pointers;
+    for (size_t i = 0; i < input_files.size(); ++i) {
+        if (!inputs[i].open(input_files[i], in_place && i == 0)) {
+            return false;
+        }
+        if (inputs[i].shape != inputs[0].shape) {
+            fmt::print("{} has a different shape than {}.\n", input_files[i], input_files[0]);
+            return false;
+        }
+        pointers.push_back(inputs[i].data);
+    }
+
+    MappedArray created;
+    if (!in_place && !created.create(output_file, inputs[0].shape)) {
+        return false;
+    }
+    float* output = in_place ? inputs[0].data : created.data;
+    const uint32_t count = inputs[0].count;
+
+    const uint32_t nchunks = (count + ChunkSize - 1) / ChunkSize;
+    vector<float> lows(nchunks, numeric_limits<float>::max());
+    vector<float> highs(nchunks, numeric_limits<float>::lowest());
+    parallel_for(count, ChunkSize, [&](uint32_t begin, uint32_t end) {
+        vector<float> scratch(depth * BlockSize);
+        vector<float const*> stack(depth);
+        float low = numeric_limits<float>::max();
+        float high = numeric_limits<float>::lowest();
+        for (uint32_t offset = begin; offset < end; offset += BlockSize) {
+            const uint32_t n = std::min(BlockSize, end - offset);
+            const uint32_t nvector = n & ~7u;
+            float* dst = output + offset;
+            if (nvector > 0) {
+                float const* src = execute_fn(program, pointers, offset, nvector,
+                        scratch.data(), stack.data());
+                if (src != dst) std::copy(src, src + nvector, dst);
+            }
+            if (nvector < n) {
+                float const* src = execute_scalar(program, pointers, offset + nvector,
+                        n - nvector, scratch.data(), stack.data());
+                if (src != dst + nvector) std::copy(src, src + n - nvector, dst + nvector);
+            }
+            const auto range = std::minmax_element(dst, dst + n);
+            low = std::min(low, *range.first);
+            high = std::max(high, *range.second);
+        }
+        lows[begin / ChunkSize] = low;
+        highs[begin / ChunkSize] = high;
+    });
+
+    if (count > 0) {
+        fmt::print("SDF range is {} to {}\n", *std::min_element(lows.begin(), lows.end()),
+                *std::max_element(highs.begin(), highs.end()));
+    }
+    return true;
+}
+
+} // anonymous namespace
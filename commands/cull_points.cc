@@ -83,8 +83,8 @@ bool CullPoints::exec(vector<string> vargs) {
         return false;
     }
     Image sdf {
-        .width = (uint32_t) img.shape[1],
         .height = (uint32_t) img.shape[0],
+        .width = (uint32_t) img.shape[1],
         .pixels = img.data<float>()
     };
 
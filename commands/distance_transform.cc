@@ -0,0 +1,163 @@
+#include "clumpy_command.hh"
+#include "clumpy_parallel.hh"
+#include "fmt/core.h"
+#include "cnpy/cnpy.h"
+
+#include <algorithm>
+#include <cmath>
+
+using std::vector;
+using std::string;
+
+namespace {
+
+struct DistanceTransform : ClumpyCommand {
+    DistanceTransform() {}
+    bool exec(vector<string> args) override;
+    string description() const override {
+        return "compute the exact signed distance field of a mask";
+    }
+    string usage() const override {
+        return "<input_img> <output_img>";
+    }
+    string example() const override {
+        return "mask.npy sdf.npy";
+    }
+};
+
+static ClumpyCommand::Register registrar("distance_transform", [] {
+    return new DistanceTransform();
+});
+
+constexpr double Infinity = 1e20;
+
+// Felzenszwalb and Huttenlocher's linear-time 1D squared distance transform, which computes the
+// lower envelope of parabolas rooted at each sample of f. The v and z arrays are scratch space for
+// n and n + 1 entries.
+void distance_transform_1d(double const* f, int32_t n, double* d, int32_t* v, double* z) {
+    int32_t k = 0;
+    v[0] = 0;
+    z[0] = -Infinity;
+    z[1] = +Infinity;
+    for (int32_t q = 1; q < n; ++q) {
+        auto intersect = [&](int32_t p) {
+            return ((f[q] + double(q) * q) - (f[p] + double(p) * p)) / (2.0 * (q - p));
+        };
+        double s = intersect(v[k]);
+        while (s <= z[k]) {
+            s = intersect(v[--k]);
+        }
+        ++k;
+        v[k] = q;
+        z[k] = s;
+        z[k + 1] = +Infinity;
+    }
+    k = 0;
+    for (int32_t q = 0; q < n; ++q) {
+        while (z[k + 1] < q) ++k;
+        const double delta = q - v[k];
+        d[q] = delta * delta + f[v[k]];
+    }
+}
+
+// Computes the squared distance in pixels from every pixel to the nearest pixel whose mask value
+// matches the given one. Rows are transformed in parallel, then columns.
+void squared_distances(vector<uint8_t> const& mask, uint8_t target, uint32_t width,
+        uint32_t height, vector<double>* result) {
+    result->resize(width * height);
+    double* grid = result->data();
+    parallel_for(height, 16, [&](uint32_t begin, uint32_t end) {
+        vector<double> f(width);
+        vector<int32_t> v(width);
+        vector<double> z(width + 1);
+        for (uint32_t row = begin; row < end; ++row) {
+            uint8_t const* src = mask.data() + row * width;
+            for (uint32_t col = 0; col < width; ++col) {
+                f[col] = src[col] == target ? 0 : Infinity;
+            }
+            distance_transform_1d(f.data(), width, grid + row * width, v.data(), z.data());
+        }
+    });
+    parallel_for(width, 16, [&](uint32_t begin, uint32_t end) {
+        vector<double> f(height), d(height);
+        vector<int32_t> v(height);
+        vector<double> z(height + 1);
+        for (uint32_t col = begin; col < end; ++col) {
+            for (uint32_t row = 0; row < height; ++row) {
+                f[row] = grid[row * width + col];
+            }
+            distance_transform_1d(f.data(), height, d.data(), v.data(), z.data());
+            for (uint32_t row = 0; row < height; ++row) {
+                grid[row * width + col] = d[row];
+            }
+        }
+    });
+}
+
+// The mask is inside wherever a uint8 input is non-zero, or wherever a float input is non-positive.
+// The latter matches the convention of cull_points and visualize_sdf, which allows an existing field
+// to be redistanced.
+//
+// The output is negative inside and positive outside, with the zero crossing halfway between
+// adjacent inside and outside pixel centers. Distances are in the units of generate_dshapes, where
+// the shorter image dimension spans 1.0.
+bool DistanceTransform::exec(vector<string> vargs) {
+    if (vargs.size() != 2) {
+        fmt::print("This command takes 2 arguments.\n");
+        return false;
+    }
+    const string input_file = vargs[0];
+    const string output_file = vargs[1];
+
+    cnpy::NpyArray arr = cnpy::npy_load(input_file);
+    if (arr.shape.size() != 2) {
+        fmt::print("Input data has wrong shape.\n");
+        return false;
+    }
+    const uint32_t height = arr.shape[0];
+    const uint32_t width = arr.shape[1];
+    const uint32_t npixels = width * height;
+
+    vector<uint8_t> inside(npixels);
+    if (arr.word_size == sizeof(float) && arr.type_code == 'f') {
+        float const* src = arr.data<float>();
+        for (uint32_t i = 0; i < npixels; ++i) {
+            inside[i] = src[i] <= 0;
+        }
+    } else if (arr.word_size == sizeof(uint8_t) && arr.type_code == 'u') {
+        uint8_t const* src = arr.data<uint8_t>();
+        for (uint32_t i = 0; i < npixels; ++i) {
+            inside[i] = src[i] != 0;
+        }
+    } else {
+        fmt::print("Input data must be float32 or uint8.\n");
+        return false;
+    }
+
+    const uint32_t ninside = std::count(inside.begin(), inside.end(), 1);
+    if (ninside == 0 || ninside == npixels) {
+        fmt::print("Mask must have both inside and outside pixels.\n");
+        return false;
+    }
+
+    vector<double> to_inside, to_outside;
+    squared_distances(inside, 1, width, height, &to_inside);
+    squared_distances(inside, 0, width, height, &to_outside);
+
+    const double scale = 1.0 / std::min(width, height);
+    vector<float> result(npixels);
+    parallel_for(height, 64, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin * width; i < end * width; ++i) {
+            result[i] = inside[i] ?
+                    -scale * (std::sqrt(to_outside[i]) - 0.5) :
+                    scale * (std::sqrt(to_inside[i]) - 0.5);
+        }
+    });
+
+    const auto range = std::minmax_element(result.begin(), result.end());
+    fmt::print("SDF range is {} to {}\n", *range.first, *range.second);
+    cnpy::npy_save(output_file, result.data(), {height, width}, "w");
+    return true;
+}
+
+} // anonymous namespace
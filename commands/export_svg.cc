@@ -0,0 +1,203 @@
+#include "clumpy_command.hh"
+#include "fmt/core.h"
+#include "fmt/format.h"
+#include "cnpy/cnpy.h"
+#include "svg/simple_svg_1.0.0.hpp"
+
+#include <glm/vec2.hpp>
+#include <glm/ext.hpp>
+
+#include <cmath>
+
+using namespace glm;
+
+using std::vector;
+using std::string;
+
+bool load_offsets(string const& filename, vector<uint64_t>* offsets);
+
+namespace {
+
+struct ExportSvg : ClumpyCommand {
+    ExportSvg() {}
+    bool exec(vector<string> args) override;
+    string description() const override {
+        return "draw point sets and polylines into a compact SVG file";
+    }
+    string usage() const override {
+        return "<dims> <output_svg> <layer> ... [radius=1] [width=1] [precision=1]";
+    }
+    string example() const override {
+        return "1024x512 figure.svg coast.npy:rings.npy bridson.npy radius=2";
+    }
+};
+
+static ClumpyCommand::Register registrar("export_svg", [] {
+    return new ExportSvg();
+});
+
+// A single path element that holds an entire layer. Coordinates are rounded to a fixed number of
+// decimal places, and every coordinate after the first is relative to the previous one, which
+// keeps the numbers short. The rounded absolute position is tracked, so rounding never drifts.
+class QuantizedPath : public svg::Shape {
+public:
+    QuantizedPath(int precision, svg::Stroke const& stroke)
+            : svg::Shape(svg::Fill(), stroke), scale(std::pow(10.0, precision)),
+            precision(precision) {}
+
+    // Adds a dot, drawn as a zero-length segment with a round cap.
+    void add_point(vec2 p) {
+        const i64vec2 q = quantize(p);
+        data += fmt::format("m{}h0", delta(q));
+        current = q;
+    }
+
+    // Adds a polyline, which is closed if its first and last points are equal. Consecutive points
+    // that round to the same position are dropped.
+    void add_polyline(vec2 const* points, size_t count) {
+        if (count < 2) return;
+        const bool closed = points[0] == points[count - 1];
+        const i64vec2 start = quantize(points[0]);
+        string subpath = fmt::format("m{}l", delta(start));
+        i64vec2 previous = start;
+        size_t nsegments = 0;
+        for (size_t i = 1; i < (closed ? count - 1 : count); ++i) {
+            const i64vec2 q = quantize(points[i]);
+            if (q == previous) continue;
+            subpath += (nsegments++ ? " " : "") + format_pair(q - previous);
+            previous = q;
+        }
+        if (nsegments == 0) return;
+        data += closed ? subpath + "z" : subpath;
+        current = closed ? start : previous;
+    }
+
+    std::string toString(svg::Layout const& layout) const override {
+        return svg::elemStart("path") + svg::attribute("d", data) + fill.toString(layout) +
+                stroke.toString(layout) + svg::attribute("stroke-linecap", "round") +
+                svg::attribute("stroke-linejoin", "round") + svg::emptyElemEnd();
+    }
+
+    void offset(svg::Point const&) override {}
+
+private:
+    i64vec2 quantize(vec2 p) const {
+        return i64vec2(std::llround(p.x * scale), std::llround(p.y * scale));
+    }
+
+    string delta(i64vec2 q) const {
+        return format_pair(q - current);
+    }
+
+    string format_pair(i64vec2 q) const {
+        return format_number(q.x) + "," + format_number(q.y);
+    }
+
+    // Formats a quantized value with trailing zeros and a leading zero removed, as in "-.5".
+    string format_number(int64_t value) const {
+        const string sign = value < 0 ? "-" : "";
+        const uint64_t magnitude = std::abs(value);
+        const uint64_t divisor = uint64_t(scale);
+        const uint64_t whole = magnitude / divisor;
+        uint64_t fraction = magnitude % divisor;
+        if (fraction == 0) {
+            return sign + std::to_string(whole);
+        }
+        int digits = precision;
+        while (fraction % 10 == 0) {
+            fraction /= 10;
+            --digits;
+        }
+        return sign + (whole ? std::to_string(whole) : "") + "." +
+                fmt::format("{:0{}}", fraction, digits);
+    }
+
+    const double scale;
+    const int precision;
+    i64vec2 current = i64vec2(0);
+    string data;
+};
+
+// Each layer is either an Nx2 array of points, drawn as dots, or a points array and an offsets
+// array joined by a colon, drawn as polylines. The polyline layout is the output of
+// extract_contours and the input of polygon_sdf. Coordinates are in pixels, and dims is the size of
+// the drawing in pixels.
+//
+// Each layer becomes a single path element with coordinates rounded to the given number of decimal
+// places, so a figure with many thousands of dots or lines stays small and renders at any
+// resolution. The radius of dots and the width of lines are in pixels.
+bool ExportSvg::exec(vector<string> vargs) {
+    Options options = extract_options(vargs);
+    if (!check_options(options, {"radius", "width", "precision"})) {
+        return false;
+    }
+    if (vargs.size() < 3) {
+        fmt::print("This command takes at least 3 arguments.\n");
+        return false;
+    }
+    const string dims = vargs[0];
+    const uint32_t width = atoi(dims.c_str());
+    const uint32_t height = atoi(dims.substr(dims.find('x') + 1).c_str());
+    const string output_file = vargs[1];
+    const vector<string> layers(vargs.begin() + 2, vargs.end());
+    const float radius = options.count("radius") ? atof(options["radius"].c_str()) : 1;
+    const float line_width = options.count("width") ? atof(options["width"].c_str()) : 1;
+    const int precision = options.count("precision") ? atoi(options["precision"].c_str()) : 1;
+    if (precision < 0 || precision > 6) {
+        fmt::print("Precision must be between 0 and 6.\n");
+        return false;
+    }
+
+    const svg::Layout layout(svg::Dimensions(width, height), svg::Layout::TopLeft);
+    svg::Document document(output_file, layout);
+    for (auto const& layer : layers) {
+        const size_t colon = layer.find(':');
+        const string points_file = layer.substr(0, colon);
+        cnpy::NpyArray arr = cnpy::npy_load(points_file);
+        if (arr.shape.size() != 2 || arr.shape[1] != 2) {
+            fmt::print("{} has wrong shape.\n", points_file);
+            return false;
+        }
+        if (arr.word_size != sizeof(float) || arr.type_code != 'f') {
+            fmt::print("{} has wrong data type.\n", points_file);
+            return false;
+        }
+        const size_t npoints = arr.shape[0];
+        vec2 const* points = arr.data<vec2>();
+
+        if (colon == string::npos) {
+            QuantizedPath path(precision, svg::Stroke(2 * radius, svg::Color::Black));
+            for (size_t i = 0; i < npoints; ++i) {
+                path.add_point(points[i]);
+            }
+            document << path;
+            continue;
+        }
+
+        vector<uint64_t> offsets;
+        if (!load_offsets(layer.substr(colon + 1), &offsets)) {
+            fmt::print("Offsets must be a 1D array of non-negative 32-bit or 64-bit integers.\n");
+            return false;
+        }
+        if (offsets.empty() || offsets.back() != npoints) {
+            offsets.push_back(npoints);
+        }
+        QuantizedPath path(precision, svg::Stroke(line_width, svg::Color::Black));
+        for (size_t i = 0; i + 1 < offsets.size(); ++i) {
+            if (offsets[i] > offsets[i + 1] || offsets[i + 1] > npoints) {
+                fmt::print("Offsets are out of range.\n");
+                return false;
+            }
+            path.add_polyline(points + offsets[i], offsets[i + 1] - offsets[i]);
+        }
+        document << path;
+    }
+
+    if (!document.save()) {
+        fmt::print("Unable to write {}.\n", output_file);
+        return false;
+    }
+    return true;
+}
+
+} // anonymous namespace
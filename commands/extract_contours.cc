@@ -0,0 +1,317 @@
+#include "clumpy_command.hh"
+#include "clumpy_parallel.hh"
+#include "fmt/core.h"
+#include "cnpy/cnpy.h"
+
+#include <glm/vec2.hpp>
+#include <glm/ext.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <unordered_map>
+
+using namespace glm;
+
+using std::vector;
+using std::string;
+using std::unordered_map;
+
+namespace {
+
+struct ExtractContours : ClumpyCommand {
+    ExtractContours() {}
+    bool exec(vector<string> args) override;
+    string description() const override {
+        return "extract isolines from an image as polylines with marching squares";
+    }
+    string usage() const override {
+        return "<input_img> <levels> <output_pts> <output_offsets> [simplify=0]";
+    }
+    string example() const override {
+        return "terrain.npy 0.0,0.25 coast.npy rings.npy simplify=0.5";
+    }
+};
+
+static ClumpyCommand::Register registrar("extract_contours", [] {
+    return new ExtractContours();
+});
+
+// Rows of cells per parallel strip.
+constexpr uint32_t StripSize = 64;
+
+// A chain of crossing points. The endpoints are identified by the grid edges they lie on, where
+// the horizontal edge to the right of pixel (x, y) is 2 * (y * width + x) and the vertical edge
+// below it is one more.
+struct Chain {
+    vector<vec2> points;
+    uint64_t first, last;
+    bool closed;
+};
+
+struct Segment {
+    uint64_t from, to;
+    vec2 a, b;
+};
+
+// Emits the oriented segments of one cell. Corners are visited clockwise from the top left, and
+// edge k joins corner k to corner k + 1. Each segment runs from an edge where the clockwise walk
+// leaves the region below the level to one where it enters it, so the region below is always on
+// the same side. Saddles are resolved with the average of the four corners.
+void march_cell(float const* image, uint32_t width, uint32_t x, uint32_t y, float level,
+        vector<Segment>* segments) {
+    const float v[4] = {
+        image[y * width + x], image[y * width + x + 1],
+        image[(y + 1) * width + x + 1], image[(y + 1) * width + x]};
+    const bool below[4] = {v[0] < level, v[1] < level, v[2] < level, v[3] < level};
+    const int nbelow = below[0] + below[1] + below[2] + below[3];
+    if (nbelow == 0 || nbelow == 4) return;
+
+    // Crossings are interpolated left to right or top to bottom, so that both cells that share an
+    // edge compute the same point.
+    const uint64_t base = 2 * (uint64_t(y) * width + x);
+    const uint64_t ids[4] = {base, base + 3, base + 2 * width, base + 1};
+    auto crossing = [&](int edge) {
+        const float v0 = edge == 1 ? v[1] : edge == 2 ? v[3] : v[0];
+        const float v1 = edge == 0 ? v[1] : edge == 3 ? v[3] : v[2];
+        const float t = (level - v0) / (v1 - v0);
+        switch (edge) {
+            case 0: return vec2(x + t, y);
+            case 1: return vec2(x + 1, y + t);
+            case 2: return vec2(x + t, y + 1);
+            default: return vec2(x, y + t);
+        }
+    };
+    auto emit = [&](int from, int to) {
+        segments->push_back({ids[from], ids[to], crossing(from), crossing(to)});
+    };
+
+    if (nbelow == 2 && below[0] == below[2]) {
+        const bool center_below = (v[0] + v[1] + v[2] + v[3]) * 0.25f < level;
+        for (int k = 0; k < 4; ++k) {
+            const int previous = (k + 3) % 4;
+            if (center_below && !below[k]) emit(previous, k);
+            if (!center_below && below[k]) emit(k, previous);
+        }
+        return;
+    }
+    int exit = 0, entry = 0;
+    for (int k = 0; k < 4; ++k) {
+        const bool next = below[(k + 1) % 4];
+        if (below[k] && !next) exit = k;
+        if (!below[k] && next) entry = k;
+    }
+    emit(exit, entry);
+}
+
+// Links segments into chains by matching the edge where each one ends to the edge where another
+// one starts. Chains that do not close on themselves end on the image border or the strip border.
+// A closed chain ends with the point it started with, since both lie on the same edge.
+template <typename Piece, typename Append>
+vector<Chain> link(vector<Piece> const& pieces, Append append) {
+    unordered_map<uint64_t, uint32_t> starts;
+    unordered_map<uint64_t, uint32_t> ends;
+    for (uint32_t i = 0; i < pieces.size(); ++i) {
+        starts[pieces[i].first_id()] = i;
+        ends[pieces[i].last_id()] = i;
+    }
+    vector<Chain> chains;
+    vector<uint8_t> used(pieces.size());
+    auto follow = [&](uint32_t head) {
+        Chain chain;
+        chain.first = pieces[head].first_id();
+        chain.closed = false;
+        uint32_t i = head;
+        while (true) {
+            used[i] = 1;
+            append(pieces[i], &chain.points);
+            chain.last = pieces[i].last_id();
+            auto next = starts.find(chain.last);
+            if (next == starts.end()) break;
+            if (used[next->second]) {
+                chain.closed = next->second == head;
+                break;
+            }
+            i = next->second;
+        }
+        chains.push_back(std::move(chain));
+    };
+    for (uint32_t i = 0; i < pieces.size(); ++i) {
+        if (!ends.count(pieces[i].first_id())) follow(i);
+    }
+    for (uint32_t i = 0; i < pieces.size(); ++i) {
+        if (!used[i]) follow(i);
+    }
+    return chains;
+}
+
+struct SegmentPiece {
+    Segment segment;
+    uint64_t first_id() const { return segment.from; }
+    uint64_t last_id() const { return segment.to; }
+};
+
+struct ChainPiece {
+    Chain const* chain;
+    uint64_t first_id() const { return chain->first; }
+    uint64_t last_id() const { return chain->last; }
+};
+
+// Marks the points to keep with the Douglas-Peucker algorithm, using an explicit stack.
+void simplify(vector<vec2> const& points, float tolerance, vector<uint8_t>* keep) {
+    keep->assign(points.size(), 0);
+    keep->front() = keep->back() = 1;
+    vector<std::pair<uint32_t, uint32_t>> stack = {{0, uint32_t(points.size() - 1)}};
+    while (!stack.empty()) {
+        const uint32_t first = stack.back().first;
+        const uint32_t last = stack.back().second;
+        stack.pop_back();
+        const vec2 a = points[first];
+        const vec2 ab = points[last] - a;
+        const float len2 = dot(ab, ab);
+        float farthest = 0;
+        uint32_t index = first;
+        for (uint32_t i = first + 1; i < last; ++i) {
+            const vec2 ap = points[i] - a;
+            const float t = len2 > 0 ? clamp(dot(ap, ab) / len2, 0.0f, 1.0f) : 0.0f;
+            const float d = length(ap - t * ab);
+            if (d > farthest) {
+                farthest = d;
+                index = i;
+            }
+        }
+        if (farthest > tolerance) {
+            (*keep)[index] = 1;
+            stack.push_back({first, index});
+            stack.push_back({index, last});
+        }
+    }
+}
+
+// Traces the isolines of each level with marching squares, where pixel centers are the grid
+// points. Strips of rows are traced and linked in parallel, then chains are stitched across strip
+// borders. The output points are in pixels, with x as the column and y as the row, and the offsets
+// are the index of the first point of each polyline, which matches the input of polygon_sdf.
+// Polylines are ordered by level.
+//
+// Pixels below a level are on the left of their isolines when viewed with y pointing up. Closed
+// polylines repeat their first point at the end. Polylines that touch the image border are open.
+// If simplify is non-zero, points within that many pixels of the simplified polyline are removed.
+bool ExtractContours::exec(vector<string> vargs) {
+    Options options = extract_options(vargs);
+    if (!check_options(options, {"simplify"})) {
+        return false;
+    }
+    if (vargs.size() != 4) {
+        fmt::print("This command takes 4 arguments.\n");
+        return false;
+    }
+    const string input_file = vargs[0];
+    string level_list = vargs[1];
+    const string output_pts = vargs[2];
+    const string output_offsets = vargs[3];
+    const float tolerance = options.count("simplify") ? atof(options["simplify"].c_str()) : 0;
+
+    vector<float> levels;
+    while (true) {
+        levels.push_back(atof(level_list.c_str()));
+        const size_t comma = level_list.find(',');
+        if (comma == string::npos) break;
+        level_list = level_list.substr(comma + 1);
+    }
+
+    cnpy::NpyArray arr = cnpy::npy_load(input_file);
+    if (arr.shape.size() != 2) {
+        fmt::print("Input data has wrong shape.\n");
+        return false;
+    }
+    if (arr.word_size != sizeof(float) || arr.type_code != 'f') {
+        fmt::print("Input data has wrong data type.\n");
+        return false;
+    }
+    const uint32_t height = arr.shape[0];
+    const uint32_t width = arr.shape[1];
+    if (width < 2 || height < 2) {
+        fmt::print("Input must be at least 2x2.\n");
+        return false;
+    }
+    float const* image = arr.data<float>();
+
+    auto append_segment = [](SegmentPiece const& piece, vector<vec2>* points) {
+        if (points->empty()) points->push_back(piece.segment.a);
+        points->push_back(piece.segment.b);
+    };
+    auto append_chain = [](ChainPiece const& piece, vector<vec2>* points) {
+        const auto begin = piece.chain->points.begin() + (points->empty() ? 0 : 1);
+        points->insert(points->end(), begin, piece.chain->points.end());
+    };
+
+    const uint32_t nstrips = (height - 1 + StripSize - 1) / StripSize;
+    vector<Chain> polylines;
+    for (float level : levels) {
+        vector<vector<Chain>> strips(nstrips);
+        parallel_for(nstrips, 1, [&](uint32_t begin, uint32_t end) {
+            vector<Segment> segments;
+            vector<SegmentPiece> pieces;
+            for (uint32_t strip = begin; strip < end; ++strip) {
+                segments.clear();
+                const uint32_t row_end = std::min(height - 1, (strip + 1) * StripSize);
+                for (uint32_t y = strip * StripSize; y < row_end; ++y) {
+                    for (uint32_t x = 0; x + 1 < width; ++x) {
+                        march_cell(image, width, x, y, level, &segments);
+                    }
+                }
+                pieces.clear();
+                for (auto const& s : segments) pieces.push_back({s});
+                strips[strip] = link(pieces, append_segment);
+            }
+        });
+
+        // Closed chains are complete, and the rest are stitched to each other.
+        const size_t before = polylines.size();
+        vector<ChainPiece> open;
+        for (auto const& strip : strips) {
+            for (auto const& chain : strip) {
+                if (chain.closed) {
+                    polylines.push_back(chain);
+                } else {
+                    open.push_back({&chain});
+                }
+            }
+        }
+        vector<Chain> stitched = link(open, append_chain);
+        polylines.insert(polylines.end(), stitched.begin(), stitched.end());
+        const auto first = polylines.begin() + before;
+        const auto count = polylines.end() - first;
+        const auto nclosed = std::count_if(first, polylines.end(),
+                [](Chain const& c) { return c.closed; });
+        fmt::print("Level {} has {} polylines, {} of them closed.\n", level, count, nclosed);
+    }
+
+    if (tolerance > 0) {
+        parallel_for(polylines.size(), 64, [&](uint32_t begin, uint32_t end) {
+            vector<uint8_t> keep;
+            for (uint32_t i = begin; i < end; ++i) {
+                vector<vec2>& points = polylines[i].points;
+                simplify(points, tolerance, &keep);
+                uint32_t n = 0;
+                for (uint32_t j = 0; j < points.size(); ++j) {
+                    if (keep[j]) points[n++] = points[j];
+                }
+                points.resize(n);
+            }
+        });
+    }
+
+    vector<vec2> points;
+    vector<uint32_t> offsets;
+    for (auto const& polyline : polylines) {
+        offsets.push_back(points.size());
+        points.insert(points.end(), polyline.points.begin(), polyline.points.end());
+    }
+    fmt::print("Extracted {} polylines with {} points.\n", offsets.size(), points.size());
+    cnpy::npy_save(output_pts, &points.data()->x, {points.size(), 2}, "w");
+    cnpy::npy_save(output_offsets, offsets.data(), {offsets.size()}, "w");
+    return true;
+}
+
+} // anonymous namespace
@@ -1,4 +1,5 @@
 #include "clumpy_command.hh"
+#include "clumpy_parallel.hh"
 #include "fmt/core.h"
 #include "cnpy/cnpy.h"
 
@@ -6,16 +7,33 @@
 #include <glm/ext.hpp>
 
 #include <random>
-#include <limits>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define CLUMPY_DSHAPES_AVX2 1
+#endif
 
 using namespace glm;
 
 using std::vector;
 using std::string;
-using std::numeric_limits;
 
 namespace {
 
+enum ShapeType { Line, Box, Triangle, Circle };
+
+// One randomly placed shape. The rotation matrix and line geometry are computed once per shape
+// rather than per pixel.
+struct Shape {
+    int type;
+    vec2 center;
+    float size;
+    mat2 rotation;
+    vec2 start, end;
+    vec2 direction;
+    float length;
+};
+
 struct GenerateShapes : ClumpyCommand {
     GenerateShapes() {}
     bool exec(vector<string> args) override;
@@ -23,22 +41,48 @@ struct GenerateShapes : ClumpyCommand {
         return "generate signed distance field of random shapes";
     }
     string usage() const override {
-        return "<dim> <nshapes> <seed> <output_img>";
+        return "<dim> <nshapes> <seed> <output_img> [tile=0,0,w,h] [band=0]";
     }
     string example() const override {
         return "400x200 4 26 out.npy";
     }
-    inline float shade(double u, double v, double w, double h);
+    void create_shapes(double width, double height);
+    inline float shade(double u, double v, double width, double height) const;
+    void shade_row(uint32_t col0, uint32_t row, uint32_t count, float* result) const;
+    void fill_block(uint32_t left, uint32_t top, uint32_t right, uint32_t bottom, float band,
+            float* result) const;
     int32_t nshapes;
     int32_t seed;
     std::mt19937 generator;
+    vector<Shape> shapes;
+    double dx, dy;
+    double w, h;
+    uint32_t tile[4];
 };
 
 static ClumpyCommand::Register registrar("generate_dshapes", [] {
     return new GenerateShapes();
 });
 
+// Evaluates count pixels of one row, starting at col0. The frame is the image rectangle that
+// shade() subtracts the shapes from.
+using ShadeRowFn = void (*)(vector<Shape> const& shapes, vec2 frame, double dx, double dy,
+        uint32_t col0, uint32_t row, uint32_t count, float* result);
+
+// Blocks of the quadtree mode start at this size, and are evaluated exactly below MinBlockSize.
+constexpr uint32_t RootBlockSize = 64;
+constexpr uint32_t MinBlockSize = 4;
+
+// The tile option renders only the given pixel region (left, top, width, height) of the full
+// image described by dims. Tiles match the corresponding region of a full render exactly.
+//
+// With band=0, the SDF is evaluated exactly at every pixel. A non-zero band clamps the output to
+// [-band, +band] and evaluates it with a quadtree instead. See fill_block.
 bool GenerateShapes::exec(vector<string> vargs) {
+    Options options = extract_options(vargs);
+    if (!check_options(options, {"tile", "band"})) {
+        return false;
+    }
     if (vargs.size() != 4) {
         fmt::print("This command takes 4 arguments.\n");
         return false;
@@ -49,9 +93,12 @@ bool GenerateShapes::exec(vector<string> vargs) {
     nshapes = atoi(vargs[1].c_str());
     seed = atoi(vargs[2].c_str());
     const string output_file = vargs[3].c_str();
+    const float band = options.count("band") ? atof(options["band"].c_str()) : 0;
+    if (band < 0) {
+        fmt::print("Band must be non-negative.\n");
+        return false;
+    }
 
-    double dx, dy;
-    double w, h;
     if (width > height) {
         dy = 1.0 / height;
         dx = dy;
@@ -64,25 +111,96 @@ bool GenerateShapes::exec(vector<string> vargs) {
         h = dx * height;
     }
 
-    float minval = numeric_limits<float>::max();
-    float maxval = numeric_limits<float>::lowest();
-    vector<float> result(width * height);
-    float* pdata = result.data();
-    for (int row = 0; row < height; ++row) {
-        for (int col = 0; col < width; ++col, ++pdata) {
-            double u = dx * col;
-            double v = dy * row;
-            *pdata = shade(u, v, w - dx, h - dy);
-            minval = std::min(minval, *pdata);
-            maxval = std::max(maxval, *pdata);
+    tile[0] = 0;
+    tile[1] = 0;
+    tile[2] = width;
+    tile[3] = height;
+    if (options.count("tile")) {
+        string tuple = options["tile"];
+        for (int i = 0; i < 4; ++i) {
+            tile[i] = atoi(tuple.c_str());
+            tuple = tuple.substr(tuple.find(',') + 1);
+        }
+        if (tile[2] == 0 || tile[3] == 0 || tile[0] + tile[2] > width ||
+                tile[1] + tile[3] > height) {
+            fmt::print("Tile must be a non-empty region within the image.\n");
+            return false;
         }
     }
-    fmt::print("SDF range is {} to {}\n", minval, maxval);
-    cnpy::npy_save(output_file, result.data(), {height, width}, "w");
+
+    create_shapes(w - dx, h - dy);
+
+    vector<float> result(tile[2] * tile[3]);
+    if (band > 0) {
+        const uint32_t ncols = (tile[2] + RootBlockSize - 1) / RootBlockSize;
+        const uint32_t nrows = (tile[3] + RootBlockSize - 1) / RootBlockSize;
+        parallel_for(ncols * nrows, 1, [&](uint32_t begin, uint32_t end) {
+            for (uint32_t block = begin; block < end; ++block) {
+                const uint32_t left = tile[0] + (block % ncols) * RootBlockSize;
+                const uint32_t top = tile[1] + (block / ncols) * RootBlockSize;
+                fill_block(left, top, std::min(left + RootBlockSize, tile[0] + tile[2]),
+                        std::min(top + RootBlockSize, tile[1] + tile[3]), band, result.data());
+            }
+        });
+    } else {
+        parallel_for(tile[3], 16, [&](uint32_t begin, uint32_t end) {
+            float* pdata = result.data() + begin * tile[2];
+            for (uint32_t row = tile[1] + begin; row < tile[1] + end; ++row) {
+                shade_row(tile[0], row, tile[2], pdata);
+                pdata += tile[2];
+            }
+        });
+    }
+
+    const auto range = std::minmax_element(result.begin(), result.end());
+    fmt::print("SDF range is {} to {}\n", *range.first, *range.second);
+    cnpy::npy_save(output_file, result.data(), {tile[3], tile[2]}, "w");
 
     return true;
 }
 
+// Fills the pixels in [left, right) x [top, bottom) of the clamped SDF. Every shape distance is
+// 1-Lipschitz and so is their minimum, so the SDF anywhere in the block is within the block's
+// radius of its value at the center. If that keeps the whole block beyond the band, the block is
+// filled with the clamped value. Otherwise it is split into quadrants, down to small blocks that are
+// evaluated exactly. Far from any boundary, this evaluates one sample per block instead of one per
+// pixel, and the result is identical to clamping the exact SDF.
+void GenerateShapes::fill_block(uint32_t left, uint32_t top, uint32_t right, uint32_t bottom,
+        float band, float* result) const {
+    const uint32_t stride = tile[2];
+    float* pdata = result + (top - tile[1]) * stride + (left - tile[0]);
+    const uint32_t bwidth = right - left;
+    const uint32_t bheight = bottom - top;
+
+    if (bwidth > MinBlockSize || bheight > MinBlockSize) {
+        const double ucenter = dx * 0.5 * (left + right - 1);
+        const double vcenter = dy * 0.5 * (top + bottom - 1);
+        const double radius = length(dvec2(dx * (bwidth - 1), dy * (bheight - 1))) * 0.5;
+        const float center = shade(ucenter, vcenter, w - dx, h - dy);
+        if (std::abs(center) - radius >= band) {
+            const float value = center > 0 ? band : -band;
+            for (uint32_t row = 0; row < bheight; ++row) {
+                std::fill(pdata + row * stride, pdata + row * stride + bwidth, value);
+            }
+            return;
+        }
+        const uint32_t midx = bwidth > MinBlockSize ? left + bwidth / 2 : right;
+        const uint32_t midy = bheight > MinBlockSize ? top + bheight / 2 : bottom;
+        fill_block(left, top, midx, midy, band, result);
+        if (midx < right) fill_block(midx, top, right, midy, band, result);
+        if (midy < bottom) fill_block(left, midy, midx, bottom, band, result);
+        if (midx < right && midy < bottom) fill_block(midx, midy, right, bottom, band, result);
+        return;
+    }
+
+    for (uint32_t row = top; row < bottom; ++row, pdata += stride) {
+        shade_row(left, row, bwidth, pdata);
+        for (uint32_t col = 0; col < bwidth; ++col) {
+            pdata[col] = glm::clamp(pdata[col], -band, band);
+        }
+    }
+}
+
 // "2d signed distance functions" inspired by Maarten's shadertoy:
 //     https://www.shadertoy.com/view/4dfXDn
 
@@ -90,11 +208,6 @@ float merge(float d1, float d2) {
     return min(d1, d2);
 }
 
-vec2 rotateCW(vec2 p, float a) {
-    mat2 m = mat2(cos(a), -sin(a), sin(a), cos(a));
-    return p * m;
-}
-
 float circleDist(vec2 p, float radius) {
     return length(p) - radius;
 }
@@ -119,50 +232,66 @@ float lineDist(vec2 p, vec2 start, vec2 end, float width) {
     return length( (start - p) - proj ) - (width / 2.0);
 }
 
-float GenerateShapes::shade(double u, double v, double w, double h) {
-    vec2 p = vec2(u, v);
-    float d = -boxDist(p - vec2(w / 2, h / 2), vec2(w / 2, h / 2), 0.0);
-
-    // First, check if this is hardcoded scene (seed == 0).
-
+// Draws the random shapes once, in the order that the per-pixel generator originally used. The
+// hardcoded scene (seed == 0) is a single circle.
+void GenerateShapes::create_shapes(double width, double height) {
+    shapes.clear();
     if (nshapes == 1 && seed == 0) {
-        float c = circleDist(p - vec2(w / 3, h / 2), h / 4);
-        return merge(d, c);
+        Shape circle;
+        circle.type = Circle;
+        circle.center = vec2(width / 3, height / 2);
+        circle.size = height / 4;
+        shapes.push_back(circle);
+        return;
     }
-
-    // Random shape generator.
-
     generator.seed(seed);
     std::uniform_int_distribution<> shape_rand(0, 3);
-    std::uniform_real_distribution<> x_rand(0, w);
-    std::uniform_real_distribution<> y_rand(0, h);
+    std::uniform_real_distribution<> x_rand(0, width);
+    std::uniform_real_distribution<> y_rand(0, height);
     std::uniform_real_distribution<> sz_rand(0.1, 0.3);
     std::uniform_real_distribution<> rot_rand(0, 2 * glm::pi<float>());
-
     for (int32_t i = 0; i < nshapes; ++i) {
-        float e;
-        int shape = shape_rand(generator);
+        Shape shape;
+        shape.type = shape_rand(generator);
         float randx = x_rand(generator);
         float randy = y_rand(generator);
         float randsz = sz_rand(generator);
         float randrot = rot_rand(generator);
         float linelen = 0.5 * randsz;
-        float linewid = 0.05;
-        float cornerrad = 0.05;
         vec2 linevec = vec2(cos(randrot), sin(randrot));
-        switch (shape) {
-            case 0:
-                e = lineDist(p, vec2(randx, randy) - linelen * linevec,
-                        vec2(randx, randy) + linelen * linevec, linewid);
+        shape.center = vec2(randx, randy);
+        shape.size = randsz;
+        shape.rotation = mat2(cos(randrot), -sin(randrot), sin(randrot), cos(randrot));
+        shape.start = shape.center - linelen * linevec;
+        shape.end = shape.center + linelen * linevec;
+        shape.direction = shape.start - shape.end;
+        shape.length = glm::length(shape.direction);
+        shape.direction /= shape.length;
+        shapes.push_back(shape);
+    }
+}
+
+constexpr float LineWidth = 0.05;
+constexpr float CornerRadius = 0.05;
+
+// The shapes are subtracted from the frame, which is the image rectangle.
+float shade_point(vector<Shape> const& shapes, vec2 p, vec2 frame) {
+    float d = -boxDist(p - frame / 2.0f, frame / 2.0f, 0.0);
+    for (auto const& shape : shapes) {
+        float e;
+        switch (shape.type) {
+            case Line:
+                e = lineDist(p, shape.start, shape.end, LineWidth);
                 break;
-            case 1:
-                e = boxDist(rotateCW(p - vec2(randx, randy), randrot), vec2(randsz / 2), cornerrad);
+            case Box:
+                e = boxDist((p - shape.center) * shape.rotation, vec2(shape.size / 2),
+                        CornerRadius);
                 break;
-            case 2:
-                e = triangleDist(rotateCW(p - vec2(randx, randy), randrot), randsz);
+            case Triangle:
+                e = triangleDist((p - shape.center) * shape.rotation, shape.size);
                 break;
-            case 3:
-                e = circleDist(p - vec2(randx, randy), randsz);
+            case Circle:
+                e = circleDist(p - shape.center, shape.size);
                 break;
         }
         d = merge(d, e);
@@ -170,4 +299,131 @@ float GenerateShapes::shade(double u, double v, double w, double h) {
     return d;
 }
 
+float GenerateShapes::shade(double u, double v, double width, double height) const {
+    return shade_point(shapes, vec2(u, v), vec2(width, height));
+}
+
+void shade_row_scalar(vector<Shape> const& shapes, vec2 frame, double dx, double dy,
+        uint32_t col0, uint32_t row, uint32_t count, float* result) {
+    for (uint32_t i = 0; i < count; ++i) {
+        result[i] = shade_point(shapes, vec2(dx * (col0 + i), dy * row), frame);
+    }
+}
+
+#ifdef CLUMPY_DSHAPES_AVX2
+
+#define AVX2_FN __attribute__((target("avx2"))) inline
+
+AVX2_FN __m256 abs8(__m256 x) {
+    return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), x);
+}
+
+AVX2_FN __m256 length8(__m256 x, __m256 y) {
+    return _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(x, x), _mm256_mul_ps(y, y)));
+}
+
+// Rounded box centered at the origin, with the same arithmetic as boxDist.
+AVX2_FN __m256 box8(__m256 qx, __m256 qy, __m256 sx, __m256 sy, __m256 radius) {
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 dx = _mm256_sub_ps(abs8(qx), sx);
+    const __m256 dy = _mm256_sub_ps(abs8(qy), sy);
+    const __m256 inside = _mm256_min_ps(_mm256_max_ps(dx, dy), zero);
+    const __m256 outside = length8(_mm256_max_ps(dx, zero), _mm256_max_ps(dy, zero));
+    return _mm256_sub_ps(_mm256_add_ps(inside, outside), radius);
+}
+
+// Rotates p - center by the shape's precomputed matrix, matching (p - center) * rotation.
+AVX2_FN void rotate8(Shape const& shape, __m256 px, __m256 py, __m256* qx, __m256* qy) {
+    const __m256 x = _mm256_sub_ps(px, _mm256_set1_ps(shape.center.x));
+    const __m256 y = _mm256_sub_ps(py, _mm256_set1_ps(shape.center.y));
+    *qx = _mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(shape.rotation[0][0])),
+            _mm256_mul_ps(y, _mm256_set1_ps(shape.rotation[0][1])));
+    *qy = _mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(shape.rotation[1][0])),
+            _mm256_mul_ps(y, _mm256_set1_ps(shape.rotation[1][1])));
+}
+
+AVX2_FN __m256 shape8(Shape const& shape, __m256 px, __m256 py) {
+    const __m256 zero = _mm256_setzero_ps();
+    __m256 qx, qy;
+    switch (shape.type) {
+        case Line: {
+            const __m256 sx = _mm256_sub_ps(_mm256_set1_ps(shape.start.x), px);
+            const __m256 sy = _mm256_sub_ps(_mm256_set1_ps(shape.start.y), py);
+            const __m256 dirx = _mm256_set1_ps(shape.direction.x);
+            const __m256 diry = _mm256_set1_ps(shape.direction.y);
+            __m256 t = _mm256_add_ps(_mm256_mul_ps(sx, dirx), _mm256_mul_ps(sy, diry));
+            t = _mm256_max_ps(zero, _mm256_min_ps(_mm256_set1_ps(shape.length), t));
+            const __m256 rx = _mm256_sub_ps(sx, _mm256_mul_ps(t, dirx));
+            const __m256 ry = _mm256_sub_ps(sy, _mm256_mul_ps(t, diry));
+            return _mm256_sub_ps(length8(rx, ry), _mm256_set1_ps(LineWidth / 2));
+        }
+        case Box: {
+            rotate8(shape, px, py, &qx, &qy);
+            const __m256 size = _mm256_set1_ps(shape.size / 2 - CornerRadius);
+            return box8(qx, qy, size, size, _mm256_set1_ps(CornerRadius));
+        }
+        case Triangle: {
+            rotate8(shape, px, py, &qx, &qy);
+            const __m256 slope = _mm256_add_ps(
+                    _mm256_mul_ps(abs8(qx), _mm256_set1_ps(0.866025f)),
+                    _mm256_mul_ps(qy, _mm256_set1_ps(0.5f)));
+            const __m256 e = _mm256_max_ps(slope, _mm256_xor_ps(qy, _mm256_set1_ps(-0.0f)));
+            return _mm256_sub_ps(e, _mm256_set1_ps(shape.size * 0.5f));
+        }
+        default: {
+            const __m256 x = _mm256_sub_ps(px, _mm256_set1_ps(shape.center.x));
+            const __m256 y = _mm256_sub_ps(py, _mm256_set1_ps(shape.center.y));
+            return _mm256_sub_ps(length8(x, y), _mm256_set1_ps(shape.size));
+        }
+    }
+}
+
+// Evaluates eight pixels at a time, shape by shape, so that each shape's constants are broadcast
+// once per group of pixels.
+__attribute__((target("avx2")))
+void shade_row_avx2(vector<Shape> const& shapes, vec2 frame, double dx, double dy,
+        uint32_t col0, uint32_t row, uint32_t count, float* result) {
+    const __m256 py = _mm256_set1_ps(float(dy * row));
+    const __m256 halfx = _mm256_set1_ps(frame.x / 2);
+    const __m256 halfy = _mm256_set1_ps(frame.y / 2);
+    const __m256 zero = _mm256_setzero_ps();
+    alignas(32) float us[8];
+    for (uint32_t i = 0; i < count; i += 8) {
+        for (uint32_t lane = 0; lane < 8; ++lane) {
+            us[lane] = float(dx * (col0 + i + lane));
+        }
+        const __m256 px = _mm256_load_ps(us);
+        __m256 d = box8(_mm256_sub_ps(px, halfx), _mm256_sub_ps(py, halfy), halfx, halfy, zero);
+        d = _mm256_xor_ps(d, _mm256_set1_ps(-0.0f));
+        for (auto const& shape : shapes) {
+            d = _mm256_min_ps(d, shape8(shape, px, py));
+        }
+        if (count - i >= 8) {
+            _mm256_storeu_ps(result + i, d);
+        } else {
+            alignas(32) float tail[8];
+            _mm256_store_ps(tail, d);
+            std::copy(tail, tail + (count - i), result + i);
+        }
+    }
+}
+
+#endif
+
+ShadeRowFn select_shade_row() {
+#ifdef CLUMPY_DSHAPES_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return shade_row_avx2;
+    }
+#endif
+    return shade_row_scalar;
+}
+
+const ShadeRowFn shade_row_fn = select_shade_row();
+
+void GenerateShapes::shade_row(uint32_t col0, uint32_t row, uint32_t count, float* result) const {
+    shade_row_fn(shapes, vec2(w - dx, h - dy), dx, dy, col0, row, count, result);
+}
+
 } // anonymous namespace
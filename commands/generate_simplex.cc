@@ -1,7 +1,10 @@
 #include "clumpy_command.hh"
+#include "clumpy_parallel.hh"
 #include "fmt/core.h"
 #include "cnpy/cnpy.h"
 
+#include <algorithm>
+#include <cmath>
 #include <limits>
 
 using namespace std;
@@ -13,7 +16,10 @@ struct GenerateSimplex : ClumpyCommand {
         return "generate simplex noise";
     }
     string usage() const override {
-        return "<dims> <amplitude> <frequency> <seed> <output_img>";
+        return "<dims> <amplitude> <frequency> <seed> <output_img> [mode=value] [origin=0,0] "
+                "[precision=float] [frames=1] [time_step=0.1] [loop=0] [periodic=0] [tile=0,0,w,h] "
+                "[hash=table] [warp=0] [warp_strength=4] [octaves=1] [lacunarity=2] [gain=0.5] "
+                "[bandlimit=1]";
     }
     string example() const override {
         return "400x200 1.0 16.0 26 out.npy";
@@ -29,10 +35,15 @@ static ClumpyCommand::Register registrar("generate_simplex", [] {
 struct osn_context;
 
 int open_simplex_noise(int64_t seed, struct osn_context** ctx);
+int open_simplex_noise_stateless(int64_t seed, struct osn_context** ctx);
 void open_simplex_noise_free(struct osn_context* ctx);
 int open_simplex_noise_init_perm(
     struct osn_context* ctx, int16_t p[], int nelements);
 double open_simplex_noise2(struct osn_context* ctx, double x, double y);
+double open_simplex_noise2_deriv(struct osn_context* ctx, int xsb_offset,
+    int ysb_offset, double x, double y, double deriv[2]);
+void open_simplex_noise2_split(
+    struct osn_context* ctx, double* x, double* y, int lattice[2]);
 double open_simplex_noise3(
     struct osn_context* ctx, double x, double y, double z);
 double open_simplex_noise4(
@@ -40,7 +51,91 @@ double open_simplex_noise4(
 
 // -------------------------------------------------------------------------------------------------
 
+// Per-level offsets that decorrelate the X and Y components of the warp vector.
+static const int MaxWarpDepth = 4;
+static const double WarpOffsets[MaxWarpDepth][4] = {
+    {1.7, 9.2, 8.3, 2.8},
+    {5.2, 1.3, 4.1, 7.6},
+    {3.9, 6.4, 9.7, 0.5},
+    {7.1, 3.3, 2.6, 8.9},
+};
+
+// Domain warping: moves (u, v) to (u, v) + k * w, where w is a pair of noise values evaluated at
+// the position warped by the previous level. The whole chain is evaluated per sample, so no
+// intermediate grids are stored.
+template<typename NoiseFn>
+void warp_position(NoiseFn const& noise, int depth, double strength, double* u, double* v) {
+    double wx = 0, wy = 0;
+    for (int level = 0; level < depth; ++level) {
+        double const* offsets = WarpOffsets[level];
+        const double x = *u + strength * wx;
+        const double y = *v + strength * wy;
+        wx = noise(x + offsets[0], y + offsets[1]);
+        wy = noise(x + offsets[2], y + offsets[3]);
+    }
+    *u += strength * wx;
+    *v += strength * wy;
+}
+
+// One octave of fractal noise. Octaves have consecutive seeds, and their frequency and amplitude
+// grow geometrically. In deep precision mode, each octave splits its own scaled origin.
+struct Octave {
+    struct osn_context* ctx;
+    double origin[2];
+    int lattice[2];
+    double scale;
+    double weight;
+};
+
+// Returns the weight of an octave whose noise-space unit spans the given number of pixels. Octaves
+// fade out smoothly as their units shrink from four pixels to two, which is the Nyquist limit for
+// features about one unit across. Octaves finer than that are skipped rather than rendered.
+static double octave_fade(double pixels_per_unit) {
+    const double t = std::min(std::max((4.0 - pixels_per_unit) / 2.0, 0.0), 1.0);
+    return 1.0 - t * t * (3.0 - 2.0 * t);
+}
+
+// The value mode writes one channel. The derivatives mode writes the value followed by its
+// derivatives with respect to column and row. The curl mode writes the divergence-free field
+// (-dn/drow, dn/dcol), which matches the layout and units of curl_2d and replaces the two-step
+// generate_simplex / curl_2d pipeline.
+//
+// The origin option is the noise-space position of the upper-left pixel. In the deep precision
+// mode, the origin is split into a stretched lattice point (passed to the noise function as an
+// integer offset) plus a small remainder, so that per-pixel coordinates stay small and exact at
+// any zoom depth that a double-precision origin can express.
+//
+// If frames > 1, the output is a (frames, height, width) stack sliced from 3D noise, where each
+// frame advances by time_step along the third axis. With loop=1, time instead travels around a
+// circle in the third and fourth axes of 4D noise, so the last frame flows into the first. The
+// circle's circumference is frames * time_step, which keeps the same speed as the 3D animation.
+//
+// With periodic=1, each axis of the image is wrapped around a circle in 4D noise (a flat torus),
+// so the output tiles seamlessly. The circles' circumferences match the image size, which keeps
+// the feature size of the 2D noise.
+//
+// The tile option renders only the given pixel region (left, top, width, height) of the full
+// image described by dims. Every pixel depends only on its global position, so tiles match the
+// corresponding region of a full render exactly. See the render_tiles command.
+//
+// The warp option sets the depth of a domain warp chain in the value mode, and warp_strength scales
+// its displacement in noise-space units. The warp is applied before the periodic or animated
+// mapping, so warped noise still tiles and loops.
+//
+// The octaves option sums fractal octaves whose frequencies grow by lacunarity and whose amplitudes
+// shrink by gain. With bandlimit=1, octaves above the first fade out as they approach the pixel
+// Nyquist limit and are not evaluated at all beyond it, which avoids both aliasing and wasted work.
+// The first octave is never faded, so single-octave output is unchanged.
+//
+// With hash=stateless, lattice points are hashed on the fly instead of being looked up in a
+// per-seed permutation table. Seeding is free and the pattern does not repeat every 256 cells.
 bool GenerateSimplex::exec(vector<string> vargs) {
+    Options options = extract_options(vargs);
+    if (!check_options(options, {"mode", "origin", "precision", "frames", "time_step", "loop",
+            "periodic", "tile", "hash", "warp", "warp_strength",
+            "octaves", "lacunarity", "gain", "bandlimit"})) {
+        return false;
+    }
     if (vargs.size() != 5) {
         fmt::print("The command takes 5 arguments.\n");
         return false;
@@ -52,9 +147,94 @@ bool GenerateSimplex::exec(vector<string> vargs) {
     const double frequency = atof(vargs[2].c_str());
     const int64_t seed = atoi(vargs[3].c_str());
     const string output_file = vargs[4].c_str();
+    const string mode = options.count("mode") ? options["mode"] : "value";
+
+    uint32_t nchannels;
+    if (mode == "value") {
+        nchannels = 1;
+    } else if (mode == "derivatives") {
+        nchannels = 3;
+    } else if (mode == "curl") {
+        nchannels = 2;
+    } else {
+        fmt::print("Mode must be value/derivatives/curl.\n");
+        return false;
+    }
 
-    struct osn_context* ctx;
-    open_simplex_noise(seed, &ctx);
+    double origin[2] = {0, 0};
+    if (options.count("origin")) {
+        const string tuple = options["origin"];
+        origin[0] = atof(tuple.c_str());
+        origin[1] = atof(tuple.substr(tuple.find(',') + 1).c_str());
+    }
+    const string precision = options.count("precision") ? options["precision"] : "float";
+    if (precision != "float" && precision != "deep") {
+        fmt::print("Precision must be float/deep.\n");
+        return false;
+    }
+    const bool deep = precision == "deep";
+
+    const uint32_t nframes = options.count("frames") ? atoi(options["frames"].c_str()) : 1;
+    const double time_step = options.count("time_step") ? atof(options["time_step"].c_str()) : 0.1;
+    const bool loop = options.count("loop") && atoi(options["loop"].c_str());
+    const bool animated = nframes > 1 || options.count("time_step") || loop;
+    if (nframes < 1) {
+        fmt::print("Frame count must be at least 1.\n");
+        return false;
+    }
+    if (animated && (nchannels != 1 || deep)) {
+        fmt::print("Animation supports only the value mode in float precision.\n");
+        return false;
+    }
+    const bool periodic = options.count("periodic") && atoi(options["periodic"].c_str());
+    if (periodic && (nchannels != 1 || deep || animated)) {
+        fmt::print("Periodic noise supports only the value mode in float precision.\n");
+        return false;
+    }
+
+    const int warp_depth = options.count("warp") ? atoi(options["warp"].c_str()) : 0;
+    const double warp_strength = options.count("warp_strength") ?
+            atof(options["warp_strength"].c_str()) : 4.0;
+    if (warp_depth < 0 || warp_depth > MaxWarpDepth) {
+        fmt::print("Warp depth must be in [0,{}].\n", MaxWarpDepth);
+        return false;
+    }
+    if (warp_depth > 0 && nchannels != 1) {
+        fmt::print("Domain warping supports only the value mode.\n");
+        return false;
+    }
+
+    const string hash = options.count("hash") ? options["hash"] : "table";
+    if (hash != "table" && hash != "stateless") {
+        fmt::print("Hash must be table/stateless.\n");
+        return false;
+    }
+
+    const int noctaves = options.count("octaves") ? atoi(options["octaves"].c_str()) : 1;
+    const double lacunarity = options.count("lacunarity") ?
+            atof(options["lacunarity"].c_str()) : 2.0;
+    const double gain = options.count("gain") ? atof(options["gain"].c_str()) : 0.5;
+    const bool bandlimit = !options.count("bandlimit") || atoi(options["bandlimit"].c_str());
+    if (noctaves < 1) {
+        fmt::print("Octave count must be at least 1.\n");
+        return false;
+    }
+
+    uint32_t tile[4] = {0, 0, width, height};
+    if (options.count("tile")) {
+        string tuple = options["tile"];
+        for (int i = 0; i < 4; ++i) {
+            tile[i] = atoi(tuple.c_str());
+            tuple = tuple.substr(tuple.find(',') + 1);
+        }
+        if (tile[2] == 0 || tile[3] == 0 || tile[0] + tile[2] > width ||
+                tile[1] + tile[3] > height) {
+            fmt::print("Tile must be a non-empty region within the image.\n");
+            return false;
+        }
+    }
+    const uint32_t tile_width = tile[2];
+    const uint32_t tile_height = tile[3];
 
     float dx;
     float dy;
@@ -66,23 +246,132 @@ bool GenerateSimplex::exec(vector<string> vargs) {
         dy = dx;
     }
 
-    float minval = numeric_limits<float>::max();
-    float maxval = numeric_limits<float>::lowest();
-    vector<float> result(width * height);
-    float* pdata = result.data();
-    for (int row = 0; row < height; ++row) {
-        for (int col = 0; col < width; ++col, ++pdata) {
-            double u = dx * col;
-            double v = dy * row;
-            *pdata = amplitude * open_simplex_noise2(ctx, u, v);
-            minval = std::min(minval, *pdata);
-            maxval = std::max(maxval, *pdata);
+    vector<Octave> octaves;
+    for (int index = 0; index < noctaves; ++index) {
+        Octave octave;
+        octave.scale = std::pow(lacunarity, double(index));
+        octave.weight = std::pow(gain, double(index));
+        if (bandlimit && index > 0) {
+            octave.weight *= octave_fade(1.0 / (dx * octave.scale));
+            if (octave.weight == 0) {
+                continue;
+            }
+        }
+        if (hash == "stateless") {
+            open_simplex_noise_stateless(seed + index, &octave.ctx);
+        } else {
+            open_simplex_noise(seed + index, &octave.ctx);
+        }
+        octave.origin[0] = origin[0] * octave.scale;
+        octave.origin[1] = origin[1] * octave.scale;
+        octave.lattice[0] = octave.lattice[1] = 0;
+        if (deep) {
+            open_simplex_noise2_split(octave.ctx, &octave.origin[0], &octave.origin[1],
+                    octave.lattice);
         }
+        octaves.push_back(octave);
+    }
+    if (octaves.size() < size_t(noctaves)) {
+        fmt::print("Skipping {} of {} octaves beyond the Nyquist limit.\n",
+                noctaves - octaves.size(), noctaves);
     }
-    fmt::print("Noise range is {} to {}\n", minval, maxval);
-    cnpy::npy_save(output_file, result.data(), {height, width}, "w");
 
-    open_simplex_noise_free(ctx);
+    const double radius = nframes * time_step / (2 * M_PI);
+    const double uperiod = double(dx) * width;
+    const double vperiod = double(dy) * height;
+
+    // The noise contexts are read-only after setup, so all frames share them. Rows of every frame are
+    // rendered concurrently.
+    const uint32_t frame_size = tile_width * tile_height * nchannels;
+    vector<float> result(nframes * frame_size);
+    parallel_for(nframes * tile_height, 16, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t index = begin; index < end; ++index) {
+            const uint32_t frame = index / tile_height;
+            const uint32_t tile_row = index % tile_height;
+            const uint32_t row = tile[1] + tile_row;
+            const double theta = 2 * M_PI * frame / nframes;
+            const double z = loop ? radius * cos(theta) : frame * time_step;
+            const double w = radius * sin(theta);
+            float* pdata = result.data() + frame * frame_size + tile_row * tile_width * nchannels;
+            // Samples one octave at an offset (du, dv) from the origin, in units of the first
+            // octave. Periodic and looping octaves scale their circles along with the frequency.
+            auto octave_at = [&](Octave const& octave, double du, double dv) {
+                struct osn_context* ctx = octave.ctx;
+                const double s = octave.scale;
+                const double u = octave.origin[0] + s * du;
+                const double v = octave.origin[1] + s * dv;
+                if (periodic) {
+                    const double uangle = 2 * M_PI * u / (uperiod * s);
+                    const double vangle = 2 * M_PI * v / (vperiod * s);
+                    const double uradius = uperiod * s / (2 * M_PI);
+                    const double vradius = vperiod * s / (2 * M_PI);
+                    return open_simplex_noise4(ctx, uradius * cos(uangle), uradius * sin(uangle),
+                            vradius * cos(vangle), vradius * sin(vangle));
+                } else if (loop) {
+                    return open_simplex_noise4(ctx, u, v, s * z, s * w);
+                } else if (animated) {
+                    return open_simplex_noise3(ctx, u, v, s * z);
+                }
+                return open_simplex_noise2_deriv(ctx, octave.lattice[0], octave.lattice[1], u, v,
+                        NULL);
+            };
+            auto value_at = [&](double du, double dv) {
+                double value = 0;
+                for (auto const& octave : octaves) {
+                    value += octave.weight * octave_at(octave, du, dv);
+                }
+                return value;
+            };
+            for (uint32_t col = tile[0]; col < tile[0] + tile_width; ++col, pdata += nchannels) {
+                double du = deep ? double(dx) * col : dx * col;
+                double dv = deep ? double(dy) * row : dy * row;
+                if (nchannels == 1) {
+                    if (warp_depth > 0) {
+                        warp_position(value_at, warp_depth, warp_strength, &du, &dv);
+                    }
+                    *pdata = amplitude * value_at(du, dv);
+                } else {
+                    double value = 0;
+                    double deriv[2] = {0, 0};
+                    for (auto const& octave : octaves) {
+                        const double s = octave.scale;
+                        double d[2];
+                        value += octave.weight * open_simplex_noise2_deriv(octave.ctx,
+                                octave.lattice[0], octave.lattice[1], octave.origin[0] + s * du,
+                                octave.origin[1] + s * dv, d);
+                        deriv[0] += octave.weight * s * d[0];
+                        deriv[1] += octave.weight * s * d[1];
+                    }
+                    const float dcol = amplitude * deriv[0] * dx;
+                    const float drow = amplitude * deriv[1] * dy;
+                    if (nchannels == 3) {
+                        pdata[0] = amplitude * value;
+                        pdata[1] = dcol;
+                        pdata[2] = drow;
+                    } else {
+                        pdata[0] = -drow;
+                        pdata[1] = dcol;
+                    }
+                }
+            }
+        }
+    });
+
+    const auto range = std::minmax_element(result.begin(), result.end());
+    fmt::print("Noise range is {} to {}\n", *range.first, *range.second);
+
+    vector<size_t> shape {tile_height, tile_width};
+    if (nchannels > 1) {
+        shape.push_back(nchannels);
+    }
+    if (animated) {
+        shape.insert(shape.begin(), nframes);
+    }
+    cnpy::npy_save(output_file, result.data(), shape, "w");
+
+    for (auto const& octave : octaves) {
+        open_simplex_noise_free(octave.ctx);
+    }
     return true;
 }
 
@@ -113,6 +402,7 @@ bool GenerateSimplex::exec(vector<string> vargs) {
 struct osn_context {
     int16_t* perm;
     int16_t* permGradIndex3D;
+    uint32_t hashSeed; /* Hashes lattice points when perm is NULL. */
 };
 
 #define ARRAYSIZE(x) (sizeof((x)) / sizeof((x)[0]))
@@ -159,12 +449,45 @@ static const signed char gradients4D[] = {
     -3, -3, -1, -1, -1, -1, -3, -1, -1, -1, -1, -3, -1, -1, -1, -1, -3,
 };
 
-static double extrapolate2(
-    struct osn_context* ctx, int xsb, int ysb, double dx, double dy)
+/*
+ * Stateless alternative to the permutation tables, using the integer hash from
+ * bridson_points. Lattice coordinates wrap modulo 2^32 rather than 256.
+ */
+static uint32_t lattice_hash(struct osn_context* ctx, uint32_t x, uint32_t y,
+    uint32_t z, uint32_t w)
 {
+    uint32_t i = x * 0x8da6b343u + y * 0xd8163841u + z * 0xcb1ab31fu +
+                 w * 0x9e3779b1u + ctx->hashSeed;
+    i = (i ^ 12345391u) * 2654435769u;
+    i ^= (i << 6) ^ (i >> 26);
+    i *= 2654435769u;
+    i += (i << 5) ^ (i >> 12);
+    return i >> 24;
+}
+
+/*
+ * Adds the contribution of one lattice vertex, (attn^4) * dot(grad, d), and optionally its
+ * analytic derivatives with respect to x and y.
+ */
+static void contribute2(struct osn_context* ctx, int xsb, int ysb, double dx,
+    double dy, double* value, double* deriv)
+{
+    double attn = 2 - dx * dx - dy * dy;
+    if (attn <= 0)
+        return;
     int16_t* perm = ctx->perm;
-    int index = perm[(perm[xsb & 0xFF] + ysb) & 0xFF] & 0x0E;
-    return gradients2D[index] * dx + gradients2D[index + 1] * dy;
+    int index = perm ? perm[(perm[xsb & 0xFF] + ysb) & 0xFF] & 0x0E
+                     : (int) lattice_hash(ctx, xsb, ysb, 0, 0) & 0x0E;
+    double gx = gradients2D[index];
+    double gy = gradients2D[index + 1];
+    double extrapolation = gx * dx + gy * dy;
+    double attn2 = attn * attn;
+    *value += attn2 * attn2 * extrapolation;
+    if (deriv) {
+        double dattn = -8 * attn2 * attn * extrapolation;
+        deriv[0] += attn2 * attn2 * gx + dattn * dx;
+        deriv[1] += attn2 * attn2 * gy + dattn * dy;
+    }
 }
 
 static double extrapolate3(struct osn_context* ctx, int xsb, int ysb, int zsb,
@@ -172,8 +495,10 @@ static double extrapolate3(struct osn_context* ctx, int xsb, int ysb, int zsb,
 {
     int16_t* perm = ctx->perm;
     int16_t* permGradIndex3D = ctx->permGradIndex3D;
-    int index =
-        permGradIndex3D[(perm[(perm[xsb & 0xFF] + ysb) & 0xFF] + zsb) & 0xFF];
+    int index = perm
+        ? permGradIndex3D[(perm[(perm[xsb & 0xFF] + ysb) & 0xFF] + zsb) & 0xFF]
+        : (int) (lattice_hash(ctx, xsb, ysb, zsb, 0) %
+                 (ARRAYSIZE(gradients3D) / 3)) * 3;
     return gradients3D[index] * dx + gradients3D[index + 1] * dy +
            gradients3D[index + 2] * dz;
 }
@@ -182,11 +507,12 @@ static double extrapolate4(struct osn_context* ctx, int xsb, int ysb, int zsb,
     int wsb, double dx, double dy, double dz, double dw)
 {
     int16_t* perm = ctx->perm;
-    int index =
-        perm[(perm[(perm[(perm[xsb & 0xFF] + ysb) & 0xFF] + zsb) & 0xFF] +
-                 wsb) &
-             0xFF] &
-        0xFC;
+    int index = perm
+        ? perm[(perm[(perm[(perm[xsb & 0xFF] + ysb) & 0xFF] + zsb) & 0xFF] +
+                  wsb) &
+              0xFF] &
+              0xFC
+        : (int) lattice_hash(ctx, xsb, ysb, zsb, wsb) & 0xFC;
     return gradients4D[index] * dx + gradients4D[index + 1] * dy +
            gradients4D[index + 2] * dz + gradients4D[index + 3] * dw;
 }
@@ -251,6 +577,7 @@ int open_simplex_noise(int64_t seed, struct osn_context** ctx)
         return -ENOMEM;
     (*ctx)->perm = NULL;
     (*ctx)->permGradIndex3D = NULL;
+    (*ctx)->hashSeed = 0;
 
     rc = allocate_perm(*ctx, 256, 256);
     if (rc) {
@@ -279,6 +606,22 @@ int open_simplex_noise(int64_t seed, struct osn_context** ctx)
     return 0;
 }
 
+/*
+ * Initializes a context that hashes lattice points instead of looking them up
+ * in permutation tables. Seeding is free, and the noise does not repeat every
+ * 256 lattice cells.
+ */
+int open_simplex_noise_stateless(int64_t seed, struct osn_context** ctx)
+{
+    *ctx = (struct osn_context*) malloc(sizeof(**ctx));
+    if (!(*ctx))
+        return -ENOMEM;
+    (*ctx)->perm = NULL;
+    (*ctx)->permGradIndex3D = NULL;
+    (*ctx)->hashSeed = (uint32_t) (seed ^ (seed >> 32)) * 0x27d4eb2fu;
+    return 0;
+}
+
 void open_simplex_noise_free(struct osn_context* ctx)
 {
     if (!ctx)
@@ -297,6 +640,23 @@ void open_simplex_noise_free(struct osn_context* ctx)
 /* 2D OpenSimplex (Simplectic) Noise. */
 double open_simplex_noise2(struct osn_context* ctx, double x, double y)
 {
+    return open_simplex_noise2_deriv(ctx, 0, 0, x, y, NULL);
+}
+
+/*
+ * 2D OpenSimplex Noise with analytic derivatives. If deriv is non-null, it
+ * receives the partial derivatives with respect to x and y.
+ *
+ * The offsets are added to the stretched lattice coordinates before hashing,
+ * which is equivalent to translating the input by the unstretched position of
+ * that lattice point. This allows x and y to stay small at any zoom depth.
+ */
+double open_simplex_noise2_deriv(struct osn_context* ctx, int xsb_offset,
+    int ysb_offset, double x, double y, double deriv[2])
+{
+    if (deriv)
+        deriv[0] = deriv[1] = 0;
+
     // Place input coordinates onto grid.
     double stretchOffset = (x + y) * STRETCH_CONSTANT_2D;
     double xs = x + stretchOffset;
@@ -324,6 +684,10 @@ double open_simplex_noise2(struct osn_context* ctx, double x, double y)
     double dx0 = x - xb;
     double dy0 = y - yb;
 
+    // Translate the lattice. Relative positions are unaffected.
+    xsb = (int) ((uint32_t) xsb + (uint32_t) xsb_offset);
+    ysb = (int) ((uint32_t) ysb + (uint32_t) ysb_offset);
+
     // We'll be defining these inside the next block and using them afterwards.
     double dx_ext, dy_ext;
     int xsv_ext, ysv_ext;
@@ -333,20 +697,12 @@ double open_simplex_noise2(struct osn_context* ctx, double x, double y)
     // Contribution (1,0)
     double dx1 = dx0 - 1 - SQUISH_CONSTANT_2D;
     double dy1 = dy0 - 0 - SQUISH_CONSTANT_2D;
-    double attn1 = 2 - dx1 * dx1 - dy1 * dy1;
-    if (attn1 > 0) {
-        attn1 *= attn1;
-        value += attn1 * attn1 * extrapolate2(ctx, xsb + 1, ysb + 0, dx1, dy1);
-    }
+    contribute2(ctx, xsb + 1, ysb + 0, dx1, dy1, &value, deriv);
 
     // Contribution (0,1)
     double dx2 = dx0 - 0 - SQUISH_CONSTANT_2D;
     double dy2 = dy0 - 1 - SQUISH_CONSTANT_2D;
-    double attn2 = 2 - dx2 * dx2 - dy2 * dy2;
-    if (attn2 > 0) {
-        attn2 *= attn2;
-        value += attn2 * attn2 * extrapolate2(ctx, xsb + 0, ysb + 1, dx2, dy2);
-    }
+    contribute2(ctx, xsb + 0, ysb + 1, dx2, dy2, &value, deriv);
 
     if (inSum <= 1) {  // We're inside the triangle (2-Simplex) at (0,0)
         double zins = 1 - inSum;
@@ -399,23 +755,38 @@ double open_simplex_noise2(struct osn_context* ctx, double x, double y)
     }
 
     // Contribution (0,0) or (1,1)
-    double attn0 = 2 - dx0 * dx0 - dy0 * dy0;
-    if (attn0 > 0) {
-        attn0 *= attn0;
-        value += attn0 * attn0 * extrapolate2(ctx, xsb, ysb, dx0, dy0);
-    }
+    contribute2(ctx, xsb, ysb, dx0, dy0, &value, deriv);
 
     // Extra Vertex
-    double attn_ext = 2 - dx_ext * dx_ext - dy_ext * dy_ext;
-    if (attn_ext > 0) {
-        attn_ext *= attn_ext;
-        value += attn_ext * attn_ext *
-                 extrapolate2(ctx, xsv_ext, ysv_ext, dx_ext, dy_ext);
-    }
+    contribute2(ctx, xsv_ext, ysv_ext, dx_ext, dy_ext, &value, deriv);
 
+    if (deriv) {
+        deriv[0] /= NORM_CONSTANT_2D;
+        deriv[1] /= NORM_CONSTANT_2D;
+    }
     return value / NORM_CONSTANT_2D;
 }
 
+/*
+ * Splits a 2D position into a stretched lattice point plus a small remainder,
+ * suitable for passing to open_simplex_noise2_deriv. The lattice coordinates
+ * are reduced modulo the permutation size, since the hash only uses their low
+ * bits. Stateless contexts reduce them modulo 2^32 instead.
+ */
+void open_simplex_noise2_split(
+    struct osn_context* ctx, double* x, double* y, int lattice[2])
+{
+    double period = ctx->perm ? 256.0 : 4294967296.0;
+    double stretchOffset = (*x + *y) * STRETCH_CONSTANT_2D;
+    double xsb = floor(*x + stretchOffset);
+    double ysb = floor(*y + stretchOffset);
+    double squishOffset = (xsb + ysb) * SQUISH_CONSTANT_2D;
+    *x -= xsb + squishOffset;
+    *y -= ysb + squishOffset;
+    lattice[0] = (int) (uint32_t) (xsb - floor(xsb / period) * period);
+    lattice[1] = (int) (uint32_t) (ysb - floor(ysb / period) * period);
+}
+
 /*
  * 3D OpenSimplex (Simplectic) Noise
  */
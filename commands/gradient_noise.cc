@@ -1,4 +1,5 @@
 #include "clumpy_command.hh"
+#include "clumpy_parallel.hh"
 #include "fmt/core.h"
 #include "cnpy/cnpy.h"
 
@@ -6,12 +7,26 @@
 #include <glm/ext.hpp>
 
 #include <algorithm>
+#include <functional>
 #include <random>
 #include <csignal>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define CLUMPY_GRADNOISE_AVX2 1
+#endif
+
 using namespace glm;
 using namespace std;
 
+void gradient_noise_layers(u32vec2 dims, uint32_t nlayers, vec4 const* viewports,
+        float const* frequencies, int const* seeds, float* result);
+struct GradientNoiseTable;
+GradientNoiseTable* create_gradient_noise_table(int seed);
+void free_gradient_noise_table(GradientNoiseTable* table);
+void gradient_noise_points(GradientNoiseTable const* table, float const* xs, float const* ys,
+        uint32_t count, int seed, float* values);
+
 namespace {
 
 #define CHECK(c) check(c, __LINE__)
@@ -33,16 +48,16 @@ u32vec2 to_ivec2(string dims) {
 }
 
 // Parses strings like "1.0,2.0,3.0,4.0"
-vec4 to_vec4(string arg) {
+dvec4 to_dvec4(string arg) {
     CHECK(arg.size() >= 7);
     string tuple = arg;
-    float x = atof(tuple.c_str());
+    double x = atof(tuple.c_str());
     tuple = tuple.substr(tuple.find(',') + 1);
-    float y = atof(tuple.c_str());
+    double y = atof(tuple.c_str());
     tuple = tuple.substr(tuple.find(',') + 1);
-    float z = atof(tuple.c_str());
+    double z = atof(tuple.c_str());
     tuple = tuple.substr(tuple.find(',') + 1);
-    float w = atof(tuple.c_str());
+    double w = atof(tuple.c_str());
     return {x, y, z, w};
 }
 
@@ -53,10 +68,13 @@ struct GradientNoise : ClumpyCommand {
         return "generate gradient noise in [-1,+1]";
     }
     string usage() const override {
-        return "<dims> <viewport> <frequency> <seed>";
+        return "<dims> <viewport> <frequency> <seed> [<viewport> <frequency> <seed> ...] "
+                "[output=gradient_noise.npy] [mode=value] [precision=float] [periodic=0] [hash=table] "
+                "[warp=0] [warp_strength=4] [bandlimit=0]";
     }
     string example() const override {
-        return "1024x1024 '-1.0,-1.0,+1.0,+1.0' 3.0 42";
+        return "1024x1024 '-1.0,-1.0,+1.0,+1.0' 3.0 42 '-0.5,-0.5,+0.5,+0.5' 6.0 43 "
+                "output=layers.npy";
     }
 };
 
@@ -66,38 +84,173 @@ static ClumpyCommand::Register registrar("gradient_noise", [] {
 
 constexpr int NoiseTableSize = 256;
 constexpr int NoiseTableMask = NoiseTableSize - 1;
-int NoiseTablePerm[NoiseTableSize];
-vec2 NoiseTableGrad[NoiseTableSize];
 
-void initnoise(uint32_t seed) {
+// Permutation and gradient tables for a given seed. These are not global, which allows several
+// layers with different seeds to be rendered concurrently.
+struct NoiseTable {
+    int perm[NoiseTableSize];
+    vec2 grad[NoiseTableSize];
+    explicit NoiseTable(uint32_t seed);
+};
+
+// The value mode writes one channel. The derivatives mode writes the value followed by its
+// derivatives with respect to column and row. The curl mode writes the divergence-free field
+// (-dn/drow, dn/dcol) in the same layout and units as the curl_2d command.
+enum class NoiseOutput { Value, Derivatives, Curl };
+
+uint32_t num_channels(NoiseOutput output) {
+    return output == NoiseOutput::Value ? 1 : output == NoiseOutput::Derivatives ? 3 : 2;
+}
+
+// Each layer is parsed in double precision. The float precision mode rounds everything to float
+// before computing sample coordinates, which is the original behavior. The deep precision mode
+// splits the coordinates into an integer lattice origin and small float offsets, so that pixels
+// stay distinct at any zoom depth that a double-precision viewport can express.
+struct NoiseLayer {
+    dvec4 viewport;
+    double frequency;
+    int seed;
+};
+
+// In periodic mode, the viewport spans a whole number of lattice cells in each direction, and the
+// cell coordinates wrap at that period so the image tiles seamlessly.
+struct NoiseSettings {
+    NoiseOutput output = NoiseOutput::Value;
+    bool deep = false;
+    bool periodic = false;
+    bool stateless = false;
+    uint32_t warp_depth = 0;
+    float warp_strength = 4.0f;
+    bool bandlimit = false;
+};
+
+// Returns the weight of a layer whose lattice cells have the given size in pixels. Layers fade out
+// smoothly as their cells shrink from four pixels to two, which is the Nyquist limit for the two
+// lobes of a gradient noise cell. Layers finer than that are skipped rather than rendered.
+float octave_fade(double pixels_per_cell) {
+    const double t = glm::clamp((4.0 - pixels_per_cell) / 2.0, 0.0, 1.0);
+    return float(1.0 - t * t * (3.0 - 2.0 * t));
+}
+
+// Returns the weight of a layer based on the pixel footprint of its viewport.
+float layer_weight(u32vec2 dims, NoiseLayer const& layer, NoiseSettings const& settings) {
+    if (!settings.bandlimit) {
+        return 1.0f;
+    }
+    const dvec4 viewport = layer.viewport;
+    const dvec2 cells = abs(dvec2(viewport.z - viewport.x, viewport.w - viewport.y)) *
+            layer.frequency;
+    const dvec2 pixels_per_cell = dvec2(dims) / cells;
+    return octave_fade(std::min(pixels_per_cell.x, pixels_per_cell.y));
+}
+
+// Cell coordinates are translated by the origin, wrapped by the period (if non-zero), then offset
+// by the seed before hashing. The origin is non-zero only in deep precision mode.
+struct NoiseLattice {
+    i32vec2 origin;
+    i32vec2 period;
+    int32_t seed;
+};
+
+int32_t wrap_cell(int32_t i, int32_t period) {
+    i %= period;
+    return i < 0 ? i + period : i;
+}
+
+bool parse_noise_output(string const& name, NoiseOutput* output) {
+    if (name == "value") *output = NoiseOutput::Value;
+    else if (name == "derivatives") *output = NoiseOutput::Derivatives;
+    else if (name == "curl") *output = NoiseOutput::Curl;
+    else return false;
+    return true;
+}
+
+NoiseTable::NoiseTable(uint32_t seed) {
     mt19937 randomGenerator(seed);
-    iota(NoiseTablePerm, NoiseTablePerm + NoiseTableSize, 0);
-    shuffle(NoiseTablePerm, NoiseTablePerm + NoiseTableSize, randomGenerator);
+    iota(perm, perm + NoiseTableSize, 0);
+    shuffle(perm, perm + NoiseTableSize, randomGenerator);
     for (int index = 0; index < NoiseTableMask; ++index) {
         float theta = 2.0f * pi<float>() * index / NoiseTableMask;
-        NoiseTableGrad[index] = {cosf(theta), sinf(theta)};
+        grad[index] = {cosf(theta), sinf(theta)};
     }
+    grad[NoiseTableMask] = vec2(0);
 }
 
-vec2 noisegrad(i32vec2 v) {
+vec2 noisegrad(NoiseTable const& table, i32vec2 v) {
     int i = v.x, j = v.y;
-    int hash = NoiseTablePerm[ ( NoiseTablePerm[ i & NoiseTableMask ] + j ) & NoiseTableMask ];
-    return NoiseTableGrad[hash];
+    int hash = table.perm[ ( table.perm[ i & NoiseTableMask ] + j ) & NoiseTableMask ];
+    return table.grad[hash];
+}
+
+// The stateless alternative to NoiseTable hashes the cell coordinates and the seed together, so
+// it needs no per-seed setup and does not repeat every 256 cells. The hash is randhash from
+// bridson_points.cc applied to a linear combination of the inputs.
+constexpr uint32_t HashPrimeX = 0x8da6b343u;
+constexpr uint32_t HashPrimeY = 0xd8163841u;
+constexpr uint32_t HashPrimeSeed = 0xcb1ab31fu;
+
+uint32_t randhash(uint32_t seed) {
+    uint32_t i = (seed ^ 12345391u) * 2654435769u;
+    i ^= (i << 6) ^ (i >> 26);
+    i *= 2654435769u;
+    i += (i << 5) ^ (i >> 12);
+    return i;
+}
+
+// Unit gradients shared by all seeds, indexed by the top 8 bits of the hash.
+struct HashGradients {
+    vec2 grad[NoiseTableSize];
+    HashGradients() {
+        for (int index = 0; index < NoiseTableSize; ++index) {
+            float theta = 2.0f * pi<float>() * index / NoiseTableSize;
+            grad[index] = {cosf(theta), sinf(theta)};
+        }
+    }
+};
+
+vec2 const* hash_gradients() {
+    static const HashGradients gradients;
+    return gradients.grad;
+}
+
+vec2 hashgrad(i32vec2 v, int32_t seed) {
+    const uint32_t hash = randhash(uint32_t(v.x) * HashPrimeX + uint32_t(v.y) * HashPrimeY +
+            uint32_t(seed) * HashPrimeSeed);
+    return hash_gradients()[hash >> 24];
 }
 
 // Returns gradient noise in .x and its derivatives in .yz
 // The range is well inside [-1,+1], approx [-0.7,+0.7].
-vec3 gradnoise(vec2 p, int32_t seed) {
-    i32vec2 i(floor(p));
+// If the table is null, gradients come from the stateless hash.
+vec3 gradnoise(NoiseTable const* table, vec2 p, NoiseLattice const& lattice) {
+    i32vec2 i0 = i32vec2(u32vec2(i32vec2(floor(p))) + u32vec2(lattice.origin));
+    i32vec2 i1 = i0 + 1;
     vec2 f(fract(p));
 
+    for (int axis = 0; axis < 2; ++axis) {
+        if (lattice.period[axis]) {
+            i0[axis] = wrap_cell(i0[axis], lattice.period[axis]);
+            i1[axis] = i0[axis] + 1 == lattice.period[axis] ? 0 : i0[axis] + 1;
+        }
+    }
+
     // Quintic interpolation.
     vec2 u = f*f*f*(f*(f*6.0f-15.0f)+10.0f);
 
-    vec2 ga = noisegrad( i + seed + i32vec2(0,0) );
-    vec2 gb = noisegrad( i + seed + i32vec2(1,0) );
-    vec2 gc = noisegrad( i + seed + i32vec2(0,1) );
-    vec2 gd = noisegrad( i + seed + i32vec2(1,1) );
+    vec2 ga, gb, gc, gd;
+    if (table) {
+        i0 += lattice.seed;
+        i1 += lattice.seed;
+        ga = noisegrad( *table, i32vec2(i0.x, i0.y) );
+        gb = noisegrad( *table, i32vec2(i1.x, i0.y) );
+        gc = noisegrad( *table, i32vec2(i0.x, i1.y) );
+        gd = noisegrad( *table, i32vec2(i1.x, i1.y) );
+    } else {
+        ga = hashgrad( i32vec2(i0.x, i0.y), lattice.seed );
+        gb = hashgrad( i32vec2(i1.x, i0.y), lattice.seed );
+        gc = hashgrad( i32vec2(i0.x, i1.y), lattice.seed );
+        gd = hashgrad( i32vec2(i1.x, i1.y), lattice.seed );
+    }
 
     float va = dot( ga, f - vec2(0,0) );
     float vb = dot( gb, f - vec2(1,0) );
@@ -115,51 +268,501 @@ vec3 gradnoise(vec2 p, int32_t seed) {
     return vec3(v, derivatives);
 }
 
+// Evaluates gradient noise at count points, given as separate arrays of X and Y coordinates.
+// Writes the noise values, and also the derivatives if ddx and ddy are non-null. If the table is
+// null, gradients come from the stateless hash.
+using GradNoisePointsFn = void (*)(NoiseTable const* table, float const* xs, float const* ys,
+        uint32_t count, NoiseLattice const& lattice, float* values, float* ddx, float* ddy);
+
+void gradnoise_points_scalar(NoiseTable const* table, float const* xs, float const* ys,
+        uint32_t count, NoiseLattice const& lattice, float* values, float* ddx, float* ddy) {
+    for (uint32_t i = 0; i < count; ++i) {
+        const vec3 n = gradnoise(table, vec2(xs[i], ys[i]), lattice);
+        values[i] = n.x;
+        if (ddx) ddx[i] = n.y;
+        if (ddy) ddy[i] = n.z;
+    }
+}
+
+#ifdef CLUMPY_GRADNOISE_AVX2
+
+#define AVX2_FN __attribute__((target("avx2"))) inline
+
+AVX2_FN __m256i permute8(int const* perm, __m256i index) {
+    const __m256i mask = _mm256_set1_epi32(NoiseTableMask);
+    return _mm256_i32gather_epi32(perm, _mm256_and_si256(index, mask), 4);
+}
+
+AVX2_FN __m256i randhash8(__m256i seed) {
+    const __m256i k = _mm256_set1_epi32(int32_t(2654435769u));
+    __m256i i = _mm256_mullo_epi32(_mm256_xor_si256(seed, _mm256_set1_epi32(12345391)), k);
+    i = _mm256_xor_si256(i, _mm256_xor_si256(_mm256_slli_epi32(i, 6), _mm256_srli_epi32(i, 26)));
+    i = _mm256_mullo_epi32(i, k);
+    return _mm256_add_epi32(i, _mm256_xor_si256(_mm256_slli_epi32(i, 5), _mm256_srli_epi32(i, 12)));
+}
+
+// Returns twice the gradient index, for gathers from interleaved X,Y pairs.
+AVX2_FN __m256i hash8(__m256i x, __m256i y, __m256i seedterm) {
+    const __m256i hx = _mm256_mullo_epi32(x, _mm256_set1_epi32(int32_t(HashPrimeX)));
+    const __m256i hy = _mm256_mullo_epi32(y, _mm256_set1_epi32(int32_t(HashPrimeY)));
+    const __m256i hash = randhash8(_mm256_add_epi32(_mm256_add_epi32(hx, hy), seedterm));
+    return _mm256_slli_epi32(_mm256_srli_epi32(hash, 24), 1);
+}
+
+// Returns the cell coordinates of the lower and upper corners, wrapped by the period if non-zero
+// and offset by the seed. The float division is exact enough for any coordinate below 2^24.
+AVX2_FN void corners8(__m256i i, int32_t period, int32_t seed, __m256i* i0, __m256i* i1) {
+    const __m256i one = _mm256_set1_epi32(1);
+    if (period) {
+        const __m256i vperiod = _mm256_set1_epi32(period);
+        const __m256 q = _mm256_floor_ps(_mm256_div_ps(_mm256_cvtepi32_ps(i),
+                _mm256_set1_ps(period)));
+        i = _mm256_sub_epi32(i, _mm256_mullo_epi32(_mm256_cvttps_epi32(q), vperiod));
+        const __m256i next = _mm256_add_epi32(i, one);
+        *i1 = _mm256_andnot_si256(_mm256_cmpeq_epi32(next, vperiod), next);
+    } else {
+        *i1 = _mm256_add_epi32(i, one);
+    }
+    const __m256i vseed = _mm256_set1_epi32(seed);
+    *i0 = _mm256_add_epi32(i, vseed);
+    *i1 = _mm256_add_epi32(*i1, vseed);
+}
+
+// f*f*f*(f*(f*6-15)+10)
+AVX2_FN __m256 fade8(__m256 f) {
+    const __m256 f3 = _mm256_mul_ps(_mm256_mul_ps(f, f), f);
+    const __m256 t = _mm256_sub_ps(_mm256_mul_ps(f, _mm256_set1_ps(6.0f)), _mm256_set1_ps(15.0f));
+    return _mm256_mul_ps(f3, _mm256_add_ps(_mm256_mul_ps(f, t), _mm256_set1_ps(10.0f)));
+}
+
+// 30*f*f*(f*(f-2)+1)
+AVX2_FN __m256 dfade8(__m256 f) {
+    const __m256 f2 = _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(30.0f), f), f);
+    const __m256 t = _mm256_mul_ps(f, _mm256_sub_ps(f, _mm256_set1_ps(2.0f)));
+    return _mm256_mul_ps(f2, _mm256_add_ps(t, _mm256_set1_ps(1.0f)));
+}
+
+AVX2_FN __m256 dot8(__m256 gx, __m256 gy, __m256 fx, __m256 fy) {
+    return _mm256_add_ps(_mm256_mul_ps(gx, fx), _mm256_mul_ps(gy, fy));
+}
+
+// a + ux*(b-a) + uy*(c-a) + ux*uy*(a-b-c+d)
+AVX2_FN __m256 bilerp8(__m256 a, __m256 b, __m256 c, __m256 d, __m256 ux, __m256 uy,
+        __m256 uxy) {
+    __m256 r = _mm256_add_ps(a, _mm256_mul_ps(ux, _mm256_sub_ps(b, a)));
+    r = _mm256_add_ps(r, _mm256_mul_ps(uy, _mm256_sub_ps(c, a)));
+    const __m256 k = _mm256_add_ps(_mm256_sub_ps(_mm256_sub_ps(a, b), c), d);
+    return _mm256_add_ps(r, _mm256_mul_ps(uxy, k));
+}
+
+// Evaluates 8 samples per iteration. The permutation and gradient tables are read with gathers,
+// and the arithmetic mirrors gradnoise() operation for operation (without FMA contraction), so
+// the results are bit-identical to the scalar path. The stateless hash is computed in lanes.
+__attribute__((target("avx2")))
+void gradnoise_points_avx2(NoiseTable const* table, float const* xs, float const* ys,
+        uint32_t count, NoiseLattice const& lattice, float* values, float* ddx, float* ddy) {
+    const __m256i xorigin = _mm256_set1_epi32(lattice.origin.x);
+    const __m256i yorigin = _mm256_set1_epi32(lattice.origin.y);
+    const __m256 fone = _mm256_set1_ps(1.0f);
+    const int32_t seed = table ? lattice.seed : 0;
+    const __m256i seedterm = _mm256_set1_epi32(int32_t(uint32_t(lattice.seed) * HashPrimeSeed));
+    int const* perm = table ? table->perm : nullptr;
+    vec2 const* grad = table ? table->grad : hash_gradients();
+    float const* gradx = &grad[0].x;
+    float const* grady = &grad[0].y;
+
+    uint32_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m256 px = _mm256_loadu_ps(xs + i);
+        const __m256 py = _mm256_loadu_ps(ys + i);
+        const __m256 flx = _mm256_floor_ps(px);
+        const __m256 fly = _mm256_floor_ps(py);
+        __m256i ix0, ix1, iy0, iy1;
+        corners8(_mm256_add_epi32(_mm256_cvttps_epi32(flx), xorigin), lattice.period.x, seed,
+                &ix0, &ix1);
+        corners8(_mm256_add_epi32(_mm256_cvttps_epi32(fly), yorigin), lattice.period.y, seed,
+                &iy0, &iy1);
+        const __m256 fx = _mm256_sub_ps(px, flx);
+        const __m256 fy = _mm256_sub_ps(py, fly);
+        const __m256 fx1 = _mm256_sub_ps(fx, fone);
+        const __m256 fy1 = _mm256_sub_ps(fy, fone);
+
+        // Hash the four lattice corners, then fetch their gradients. The gradient table holds
+        // interleaved X,Y pairs, so the gather index is twice the hash.
+        __m256i ha, hb, hc, hd;
+        if (perm) {
+            const __m256i p0 = permute8(perm, ix0);
+            const __m256i p1 = permute8(perm, ix1);
+            ha = _mm256_slli_epi32(permute8(perm, _mm256_add_epi32(p0, iy0)), 1);
+            hb = _mm256_slli_epi32(permute8(perm, _mm256_add_epi32(p1, iy0)), 1);
+            hc = _mm256_slli_epi32(permute8(perm, _mm256_add_epi32(p0, iy1)), 1);
+            hd = _mm256_slli_epi32(permute8(perm, _mm256_add_epi32(p1, iy1)), 1);
+        } else {
+            ha = hash8(ix0, iy0, seedterm);
+            hb = hash8(ix1, iy0, seedterm);
+            hc = hash8(ix0, iy1, seedterm);
+            hd = hash8(ix1, iy1, seedterm);
+        }
+        const __m256 gax = _mm256_i32gather_ps(gradx, ha, 4);
+        const __m256 gay = _mm256_i32gather_ps(grady, ha, 4);
+        const __m256 gbx = _mm256_i32gather_ps(gradx, hb, 4);
+        const __m256 gby = _mm256_i32gather_ps(grady, hb, 4);
+        const __m256 gcx = _mm256_i32gather_ps(gradx, hc, 4);
+        const __m256 gcy = _mm256_i32gather_ps(grady, hc, 4);
+        const __m256 gdx = _mm256_i32gather_ps(gradx, hd, 4);
+        const __m256 gdy = _mm256_i32gather_ps(grady, hd, 4);
+
+        const __m256 va = dot8(gax, gay, fx, fy);
+        const __m256 vb = dot8(gbx, gby, fx1, fy);
+        const __m256 vc = dot8(gcx, gcy, fx, fy1);
+        const __m256 vd = dot8(gdx, gdy, fx1, fy1);
+
+        const __m256 ux = fade8(fx);
+        const __m256 uy = fade8(fy);
+        const __m256 uxy = _mm256_mul_ps(ux, uy);
+        _mm256_storeu_ps(values + i, bilerp8(va, vb, vc, vd, ux, uy, uxy));
+
+        if (ddx && ddy) {
+            const __m256 k = _mm256_add_ps(_mm256_sub_ps(_mm256_sub_ps(va, vb), vc), vd);
+            const __m256 dux = dfade8(fx);
+            const __m256 duy = dfade8(fy);
+            const __m256 tx = _mm256_sub_ps(_mm256_add_ps(_mm256_mul_ps(uy, k), vb), va);
+            const __m256 ty = _mm256_sub_ps(_mm256_add_ps(_mm256_mul_ps(ux, k), vc), va);
+            const __m256 gx = bilerp8(gax, gbx, gcx, gdx, ux, uy, uxy);
+            const __m256 gy = bilerp8(gay, gby, gcy, gdy, ux, uy, uxy);
+            _mm256_storeu_ps(ddx + i, _mm256_add_ps(gx, _mm256_mul_ps(dux, tx)));
+            _mm256_storeu_ps(ddy + i, _mm256_add_ps(gy, _mm256_mul_ps(duy, ty)));
+        }
+    }
+    gradnoise_points_scalar(table, xs + i, ys + i, count - i, lattice, values + i,
+            ddx ? ddx + i : nullptr, ddy ? ddy + i : nullptr);
+}
+
+#endif
+
+// Picks the widest implementation that the CPU supports.
+GradNoisePointsFn select_gradnoise_points() {
+#ifdef CLUMPY_GRADNOISE_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return gradnoise_points_avx2;
+    }
+#endif
+    return gradnoise_points_scalar;
+}
+
+const GradNoisePointsFn gradnoise_points = select_gradnoise_points();
+
+// Per-level offsets that decorrelate the X and Y components of the warp vector.
+constexpr uint32_t MaxWarpDepth = 4;
+const vec2 WarpOffsets[MaxWarpDepth][2] = {
+    {{1.7f, 9.2f}, {8.3f, 2.8f}},
+    {{5.2f, 1.3f}, {4.1f, 7.6f}},
+    {{3.9f, 6.4f}, {9.7f, 0.5f}},
+    {{7.1f, 3.3f}, {2.6f, 8.9f}},
+};
+
+// Domain warping: replaces each position p with p + k * w, where w is a vector of two noise
+// values evaluated at the position warped by the previous level. The warp is evaluated a row at a
+// time so that every level goes through the SIMD kernel, and nothing larger than a row is stored.
+// Warped positions stay periodic when the lattice is, since the warp is a function of the
+// wrapped lattice.
+void warp_points(NoiseTable const* table, NoiseLattice const& lattice, uint32_t depth,
+        float strength, uint32_t count, float* xs, float* ys) {
+    vector<float> wx(count, 0.0f), wy(count, 0.0f), px(count), py(count);
+    for (uint32_t level = 0; level < depth; ++level) {
+        vec2 const* offsets = WarpOffsets[level];
+        for (uint32_t i = 0; i < count; ++i) {
+            px[i] = xs[i] + strength * wx[i] + offsets[0].x;
+            py[i] = ys[i] + strength * wy[i] + offsets[0].y;
+        }
+        gradnoise_points(table, px.data(), py.data(), count, lattice, wx.data(), nullptr,
+                nullptr);
+        for (uint32_t i = 0; i < count; ++i) {
+            px[i] += offsets[1].x - offsets[0].x;
+            py[i] += offsets[1].y - offsets[0].y;
+        }
+        gradnoise_points(table, px.data(), py.data(), count, lattice, wy.data(), nullptr,
+                nullptr);
+    }
+    for (uint32_t i = 0; i < count; ++i) {
+        xs[i] += strength * wx[i];
+        ys[i] += strength * wy[i];
+    }
+}
+
+// Adds one octave of gradient noise to rows [row0, row1) of a dims-sized image.
+//
+// "Raster Space" is <ui16,ui16> with 0,0 at upper left.
+// Viewport Space is <fp32,fp32> with -,+ at upper left.
+// If the viewport is -1,-1 through +1,+1, then:
+//     -1.0 is the left  edge of pixel (0)
+//     +1.0 is the right edge of pixel (w-1)
+//     Freq=1 is a 2x2 grid of surflets
+void gradient_noise_rows(NoiseTable const* table, u32vec2 dims, NoiseLayer const& layer,
+        NoiseSettings const& settings, uint32_t row0, uint32_t row1, float* result) {
+    vector<float> xs(dims.x), ys(dims.x), values(dims.x);
+    const float weight = layer_weight(dims, layer, settings);
+    std::function<float(uint32_t)> row_y;
+    NoiseLattice lattice {i32vec2(0), i32vec2(0), layer.seed};
+    float dcol, drow;
+
+    if (settings.periodic) {
+        const dvec4 viewport = layer.viewport;
+        const dvec2 size = dvec2(viewport.z - viewport.x, viewport.w - viewport.y);
+        lattice.period = i32vec2(round(size * layer.frequency));
+    }
+
+    if (settings.deep) {
+        const dvec4 viewport = layer.viewport;
+        const double frequency = layer.frequency;
+        const double dx = (viewport.z - viewport.x) / dims.x;
+        const double dy = (viewport.w - viewport.y) / dims.y;
+        const dvec2 origin = dvec2(viewport.x + dx * 0.5, viewport.w - dy * 0.5) * frequency;
+        const dvec2 cell = floor(origin);
+        const dvec2 local = origin - cell;
+
+        // The tables repeat every 256 cells, so only the low bits of the lattice origin matter.
+        // The stateless hash wraps at 2^32 instead. In periodic mode the origin is reduced by the
+        // period.
+        for (int axis = 0; axis < 2; ++axis) {
+            double period = settings.stateless ? 4294967296.0 : NoiseTableSize;
+            if (settings.periodic) {
+                period = lattice.period[axis];
+            }
+            const double wrapped = cell[axis] - floor(cell[axis] / period) * period;
+            lattice.origin[axis] = int32_t(uint32_t(wrapped));
+        }
+
+        for (uint32_t col = 0; col < dims.x; ++col) {
+            xs[col] = local.x + col * dx * frequency;
+        }
+        row_y = [=](uint32_t row) { return float(local.y - row * dy * frequency); };
+        dcol = frequency * dx;
+        drow = -frequency * dy;
+    } else {
+        const vec4 viewport(layer.viewport);
+        const float frequency = layer.frequency;
+        const float vpwidth = viewport.z - viewport.x;
+        const float vpheight = viewport.w - viewport.y;
+        const float dx = vpwidth / dims.x;
+        const float sx = viewport.x + dx * 0.5;
+        const float dy = vpheight / dims.y;
+        const float sy = viewport.w - dy * 0.5;
+
+        for (uint32_t col = 0; col < dims.x; ++col) {
+            const float x = sx + col * dx;
+            xs[col] = x * frequency;
+        }
+        row_y = [=](uint32_t row) {
+            const float y = sy - row * dy;
+            return y * frequency;
+        };
+        dcol = frequency * dx;
+        drow = -frequency * dy;
+    }
+
+    if (settings.output == NoiseOutput::Value) {
+        vector<float> warped(dims.x);
+        float* fdata = result + row0 * dims.x;
+        for (uint32_t row = row0; row < row1; ++row, fdata += dims.x) {
+            std::fill(ys.begin(), ys.end(), row_y(row));
+            float const* rowxs = xs.data();
+            if (settings.warp_depth > 0) {
+                std::copy(xs.begin(), xs.end(), warped.begin());
+                warp_points(table, lattice, settings.warp_depth, settings.warp_strength, dims.x,
+                        warped.data(), ys.data());
+                rowxs = warped.data();
+            }
+            gradnoise_points(table, rowxs, ys.data(), dims.x, lattice, values.data(), nullptr,
+                    nullptr);
+            for (uint32_t col = 0; col < dims.x; ++col) {
+                fdata[col] += values[col] * weight;
+            }
+        }
+        return;
+    }
+
+    // Derivatives are converted from noise space into per-pixel units, where rows increase
+    // downward.
+    vector<float> ddx(dims.x), ddy(dims.x);
+    const uint32_t nchannels = num_channels(settings.output);
+    float* fdata = result + row0 * dims.x * nchannels;
+    for (uint32_t row = row0; row < row1; ++row) {
+        std::fill(ys.begin(), ys.end(), row_y(row));
+        gradnoise_points(table, xs.data(), ys.data(), dims.x, lattice, values.data(), ddx.data(),
+                ddy.data());
+        for (uint32_t col = 0; col < dims.x; ++col, fdata += nchannels) {
+            if (settings.output == NoiseOutput::Derivatives) {
+                fdata[0] += values[col] * weight;
+                fdata[1] += ddx[col] * dcol * weight;
+                fdata[2] += ddy[col] * drow * weight;
+            } else {
+                fdata[0] -= ddy[col] * drow * weight;
+                fdata[1] += ddx[col] * dcol * weight;
+            }
+        }
+    }
+}
+
+// Renders all layers into consecutive images of num_channels(output) interleaved channels. With
+// bandlimit enabled, layers that are entirely above the Nyquist limit are left untouched. It is off
+// by default, since each layer is a separate image and callers decide how to sum them.
+void render_layers(u32vec2 dims, vector<NoiseLayer> const& layers, NoiseSettings const& settings,
+        float* result) {
+    vector<uint32_t> active;
+    for (uint32_t layer = 0; layer < layers.size(); ++layer) {
+        if (layer_weight(dims, layers[layer], settings) > 0) {
+            active.push_back(layer);
+        }
+    }
+    const uint32_t nactive = active.size();
+    vector<NoiseTable> tables;
+    if (!settings.stateless) {
+        tables.reserve(nactive);
+        for (uint32_t layer : active) {
+            tables.emplace_back(layers[layer].seed);
+        }
+    }
+    const size_t layer_size = size_t(dims.x) * dims.y * num_channels(settings.output);
+    parallel_for(nactive * dims.y, 32, [&](uint32_t begin, uint32_t end) {
+        while (begin < end) {
+            const uint32_t index = begin / dims.y;
+            const uint32_t layer = active[index];
+            const uint32_t row0 = begin % dims.y;
+            const uint32_t row1 = std::min(dims.y, row0 + (end - begin));
+            NoiseTable const* table = settings.stateless ? nullptr : &tables[index];
+            gradient_noise_rows(table, dims, layers[layer], settings, row0, row1,
+                    result + layer * layer_size);
+            begin += row1 - row0;
+        }
+    });
+}
+
 bool GradientNoise::exec(vector<string> vargs) {
-    if (vargs.size() != 4) {
-        fmt::print("The command takes 4 arguments.\n");
+    Options options = extract_options(vargs);
+    if (!check_options(options, {"output", "mode", "precision", "periodic", "hash", "warp",
+            "warp_strength", "bandlimit"})) {
+        return false;
+    }
+    NoiseSettings settings;
+    if (options.count("mode") && !parse_noise_output(options["mode"], &settings.output)) {
+        fmt::print("Mode must be value/derivatives/curl.\n");
+        return false;
+    }
+    if (options.count("precision")) {
+        const string precision = options["precision"];
+        if (precision != "float" && precision != "deep") {
+            fmt::print("Precision must be float/deep.\n");
+            return false;
+        }
+        settings.deep = precision == "deep";
+    }
+    settings.periodic = options.count("periodic") && atoi(options["periodic"].c_str());
+    if (options.count("hash")) {
+        const string hash = options["hash"];
+        if (hash != "table" && hash != "stateless") {
+            fmt::print("Hash must be table/stateless.\n");
+            return false;
+        }
+        settings.stateless = hash == "stateless";
+    }
+    if (options.count("bandlimit")) {
+        settings.bandlimit = atoi(options["bandlimit"].c_str());
+    }
+    if (options.count("warp")) {
+        const int depth = atoi(options["warp"].c_str());
+        if (depth < 0 || depth > int(MaxWarpDepth)) {
+            fmt::print("Warp depth must be in [0,{}].\n", MaxWarpDepth);
+            return false;
+        }
+        settings.warp_depth = depth;
+    }
+    if (options.count("warp_strength")) {
+        settings.warp_strength = atof(options["warp_strength"].c_str());
+    }
+    if (settings.warp_depth > 0 && settings.output != NoiseOutput::Value) {
+        fmt::print("Domain warping supports only the value mode.\n");
+        return false;
+    }
+    if (vargs.size() < 4 || (vargs.size() - 1) % 3 != 0) {
+        fmt::print("The command takes dims followed by one or more viewport/frequency/seed "
+                "triples.\n");
         return false;
     }
     const u32vec2 dims = to_ivec2(vargs[0]);
-    const vec4 viewport = to_vec4(vargs[1]);
-    const float frequency = atof(vargs[2].c_str());
-    const int seed = atoi(vargs[3].c_str());
-    const string output_file = "gradient_noise.npy";
-
-    // Initialize the table of gradient vectors.
-    initnoise(seed);
-
-    // "Raster Space" is <ui16,ui16> with 0,0 at upper left.
-    // Viewport Space is <fp32,fp32> with -,+ at upper left.
-    // If the viewport is -1,-1 through +1,+1, then:
-    //     -1.0 is the left  edge of pixel (0)
-    //     +1.0 is the right edge of pixel (w-1)
-    //     Freq=1 is a 2x2 grid of surflets
-
-    const float vpwidth = viewport.z - viewport.x;
-    const float vpheight = viewport.w - viewport.y;
-    const float dx = vpwidth / dims.x;
-    const float sx = viewport.x + dx * 0.5;
-    const float dy = vpheight / dims.y;
-    const float sy = viewport.w - dy * 0.5;
-
-    auto add_octave = [&](vector<float>& grid, float freq, int seed) {
-        float* fdata = grid.data();
-        for (int row = 0; row < dims.y; ++row) {
-            const float y = sy - row * dy;
-            for (int col = 0; col < dims.x; ++col, ++fdata) {
-                const float x = sx + col * dx;
-                const vec2 p(x, y);
-                *fdata += gradnoise(p * freq, seed).x;
+    const string output_file = options.count("output") ? options["output"] : "gradient_noise.npy";
+
+    const uint32_t nlayers = (vargs.size() - 1) / 3;
+    vector<NoiseLayer> layers(nlayers);
+    for (uint32_t layer = 0; layer < nlayers; ++layer) {
+        layers[layer].viewport = to_dvec4(vargs[1 + layer * 3]);
+        layers[layer].frequency = atof(vargs[2 + layer * 3].c_str());
+        layers[layer].seed = atoi(vargs[3 + layer * 3].c_str());
+        if (settings.periodic) {
+            const dvec4 viewport = layers[layer].viewport;
+            const dvec2 cells = dvec2(viewport.z - viewport.x, viewport.w - viewport.y) *
+                    layers[layer].frequency;
+            if (any(lessThan(round(cells), dvec2(1))) ||
+                    any(greaterThan(abs(cells - round(cells)), dvec2(1e-3)))) {
+                fmt::print("Periodic layers must span a whole number of cells, "
+                        "not {}x{}.\n", cells.x, cells.y);
+                return false;
             }
         }
-    };
+    }
 
-    vector<float> result(dims.x * dims.y);
-    add_octave(result, frequency, seed);
+    const uint32_t nchannels = num_channels(settings.output);
+    vector<float> result(size_t(nlayers) * dims.x * dims.y * nchannels);
+    render_layers(dims, layers, settings, result.data());
 
-    cnpy::npy_save(output_file, result.data(), {dims.y, dims.x}, "w");
+    // A single layer keeps the original 2D shape; several layers are stacked.
+    vector<size_t> shape {dims.y, dims.x};
+    if (nchannels > 1) {
+        shape.push_back(nchannels);
+    }
+    if (nlayers > 1) {
+        shape.insert(shape.begin(), nlayers);
+    }
+    cnpy::npy_save(output_file, result.data(), shape, "w");
     return true;
 }
 
 } // anonymous namespace
+
+// Adds one octave of gradient noise to each of the nlayers dims-sized images in result, which are
+// stored consecutively. Every layer has its own viewport, frequency and seed. The noise tables are
+// built once per layer, then all layers are rendered concurrently in row chunks.
+void gradient_noise_layers(u32vec2 dims, uint32_t nlayers, vec4 const* viewports,
+        float const* frequencies, int const* seeds, float* result) {
+    vector<NoiseLayer> layers(nlayers);
+    for (uint32_t layer = 0; layer < nlayers; ++layer) {
+        layers[layer] = {dvec4(viewports[layer]), frequencies[layer], seeds[layer]};
+    }
+    render_layers(dims, layers, NoiseSettings(), result);
+}
+
+// Permutation and gradient tables for one seed, which callers that evaluate many batches of points
+// build once and reuse.
+struct GradientNoiseTable {
+    NoiseTable table;
+    explicit GradientNoiseTable(int seed) : table(seed) {}
+};
+
+GradientNoiseTable* create_gradient_noise_table(int seed) {
+    return new GradientNoiseTable(seed);
+}
+
+void free_gradient_noise_table(GradientNoiseTable* table) {
+    delete table;
+}
+
+// Evaluates gradient noise at count points with separate X and Y coordinates in noise space,
+// using the AVX2 kernel when available. The table must have been created with the same seed. If it
+// is null, gradients come from the stateless lattice hash instead.
+void gradient_noise_points(GradientNoiseTable const* table, float const* xs, float const* ys,
+        uint32_t count, int seed, float* values) {
+    const NoiseLattice lattice {i32vec2(0), i32vec2(0), seed};
+    gradnoise_points(table ? &table->table : nullptr, xs, ys, count, lattice, values, nullptr,
+            nullptr);
+}
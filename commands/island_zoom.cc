@@ -0,0 +1,313 @@
+#include "clumpy_command.hh"
+#include "clumpy_parallel.hh"
+#include "fmt/core.h"
+#include "cnpy/cnpy.h"
+
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/ext.hpp>
+
+#include <cstdio>
+
+using namespace glm;
+
+using std::vector;
+using std::string;
+
+void gradient_noise_layers(u32vec2 dims, uint32_t nlayers, vec4 const* viewports,
+        float const* frequencies, int const* seeds, float* result);
+bool resample_image(float const* src, u32vec2 srcdims, uint32_t nchannels, vec4 viewport,
+        string const& filter, float* dst, u32vec2 dstdims);
+
+namespace {
+
+// This is a native port of the frame loop in extras/island.py. All coordinates are X,Y floats
+// with values that increase rightward and downward:
+//
+//     World Space: [0,0 through 1,1] spans the entire island.
+//      Tile Space: [0,0 through 1,1] spans the smallest tile that wholly encompasses the viewport.
+//  Viewport Space: [0,0 through 1,1] spans the current view.
+//
+// Viewports are stored as (left, top, right, bottom) in tile space.
+
+const vec4 kTargetLine(0.4, 0.4, 0.9, 0.9);
+const vec2 kPanFocus(0.5, 0.5);
+const float kSeaLevel = 0.5f;
+const float kZoomSpeed = 10.0f;
+const float kPanSpeed = 0.05f;
+
+struct IslandZoom : ClumpyCommand {
+    IslandZoom() {}
+    bool exec(vector<string> args) override;
+    string description() const override {
+        return "render frames of an infinitely zooming island";
+    }
+    string usage() const override {
+        return "<dims> <nframes> <output>";
+    }
+    string example() const override {
+        return "512x512 150 - | ffmpeg -f rawvideo -pix_fmt rgb24 -s 912x512 -r 30 -i - out.mp4";
+    }
+
+    void create_viewports();
+    void update_view(uint32_t nlayers);
+    void update_tile();
+    vec2 marching_line(vector<float> const& image, vec4 segment) const;
+    vec4 shrink_viewport(vec4 viewport) const;
+    void render_view(vector<u8vec3>& frame) const;
+
+    u32vec2 dims;
+    uint32_t num_layers;
+    float noise_frequency;
+    int zoom = 0;
+    vec2 target;
+    vector<float> view_image; // Current viewport. Includes num_layers of high-freq noise.
+    vector<float> tile_image; // Smallest encompassing tile (accumulated low-freq noise).
+    vector<float> layers;
+    vector<vec4> viewports;
+    vector<u8vec3> palette;
+};
+
+static ClumpyCommand::Register registrar("island_zoom", [] {
+    return new IslandZoom();
+});
+
+// Hermite interpolation, also known as smoothstep:
+//     (-1 => 0)     (0 => 1)     (+1 => 0)
+float hermite(float t) {
+    return 1 - (3 - 2 * abs(t)) * t * t;
+}
+
+vector<u8vec3> create_palette() {
+    vector<u8vec3> palette(256);
+    for (int i = 0; i < 128; ++i) {
+        const float t = i / 127.0f;
+        palette[i] = u8vec3(0, 0, 128.0f + 127.0f * t);
+        palette[i + 128] = u8vec3(0, 128.0f + 127.0f * t, 64.0f * t);
+    }
+    return palette;
+}
+
+void IslandZoom::create_viewports() {
+    viewports.clear();
+    float frequency = 1;
+    for (uint32_t i = 0; i < num_layers; ++i) {
+        viewports.insert(viewports.begin(), vec4(0, 0, frequency, frequency));
+        frequency /= 2;
+    }
+}
+
+// Resamples the tile into the view, then adds layers of noise. The layers are independent, so
+// they are rendered concurrently in a single batch before being folded together in order.
+void IslandZoom::update_view(uint32_t nlayers) {
+    const vec4 vp = viewports.back();
+    resample_image(tile_image.data(), dims, 1, vp, "bilinear", view_image.data(), dims);
+
+    nlayers = std::min(nlayers, uint32_t(viewports.size()));
+    vector<vec4> noise_viewports(nlayers);
+    vector<float> frequencies(nlayers, noise_frequency);
+    vector<int> seeds(nlayers);
+    for (uint32_t layer = 0; layer < nlayers; ++layer) {
+        // Convert from tile space into the viewport space of gradient_noise.
+        const vec4 tvp = 2.0f * (viewports[layer] - 0.5f);
+        noise_viewports[layer] = vec4(tvp.x, -tvp.w, tvp.z, -tvp.y);
+        seeds[layer] = zoom + layer;
+    }
+
+    const uint32_t npixels = dims.x * dims.y;
+    layers.assign(nlayers * npixels, 0.0f);
+    gradient_noise_layers(dims, nlayers, noise_viewports.data(), frequencies.data(), seeds.data(),
+            layers.data());
+
+    for (uint32_t layer = 0; layer < nlayers; ++layer) {
+        float const* noise = layers.data() + layer * npixels;
+        for (uint32_t i = 0; i < npixels; ++i) {
+            view_image[i] = 2 * (view_image[i] + noise[i]);
+        }
+    }
+}
+
+void IslandZoom::update_tile() {
+    // Render a new base tile by adding one layer of noise.
+    update_view(1);
+    tile_image = view_image;
+
+    // Left-shift the viewports array and push on a new high-frequency layer.
+    viewports.erase(viewports.begin());
+    viewports.push_back(vec4(0, 0, 1, 1));
+    zoom++;
+    noise_frequency = std::min(noise_frequency * 1.5f, 512.0f);
+}
+
+// Walks along a line segment in viewport space and returns the first point where the height
+// crosses sea level.
+vec2 IslandZoom::marching_line(vector<float> const& image, vec4 segment) const {
+    auto sample_pixel = [&](float x, float y) {
+        const int32_t row = y * dims.y, col = x * dims.x;
+        if (row < 0 || col < 0 || col >= int32_t(dims.x) || row >= int32_t(dims.y)) {
+            return 0.0f;
+        }
+        return image[row * dims.x + col];
+    };
+    auto sign = [](float v) { return (v > 0) - (v < 0); };
+    const int sgn = sign(sample_pixel(segment.x, segment.y));
+    const uint32_t divs = std::max(dims.x, dims.y);
+    const vec2 delta = (vec2(segment.z, segment.w) - vec2(segment.x, segment.y)) / float(divs);
+    for (uint32_t i = 0; i < divs; ++i) {
+        const vec2 p = vec2(segment.x, segment.y) + float(i) * delta;
+        if (sign(sample_pixel(p.x, p.y)) != sgn) {
+            return p;
+        }
+    }
+    fmt::print(stderr, "Could not find sea level along {},{} -- {},{}\n", segment.x, segment.y,
+            segment.z, segment.w);
+    return vec2(0.5);
+}
+
+// Computes the pan / zoom adjustment for the given viewport.
+vec4 IslandZoom::shrink_viewport(vec4 viewport) const {
+    const vec2 extent = vec2(viewport.z, viewport.w) - vec2(viewport.x, viewport.y);
+    const vec2 pan_delta = kPanSpeed * (target - kPanFocus);
+    const vec2 zoom_delta = kZoomSpeed * extent / vec2(dims);
+    return vec4(pan_delta + zoom_delta, pan_delta - zoom_delta);
+}
+
+// Converts both heightmaps into color, draws the overlay onto the view, and places the two side
+// by side after cropping them so that the stack is roughly 16:9.
+void IslandZoom::render_view(vector<u8vec3>& frame) const {
+    const double crop = dims.x - dims.x * 960.0 / 1080.0;
+    const uint32_t col0 = uint32_t(crop / 2);
+    const uint32_t col1 = uint32_t(dims.x - crop / 2);
+    const uint32_t cropped = col1 - col0;
+    const uint32_t stride = 2 * cropped;
+    frame.resize(stride * dims.y);
+
+    auto colorize = [&](vector<float> const& image, uint32_t xoffset, bool overlay) {
+        const auto range = std::minmax_element(image.begin(), image.end());
+        const float scale = 0.5f / (*range.second - *range.first);
+
+        // The overlay is a faint line segment and a circle around the target.
+        const vec2 size(dims);
+        const vec2 a = vec2(kTargetLine.x, kTargetLine.y) * size;
+        const vec2 b = vec2(kTargetLine.z, kTargetLine.w) * size;
+        const vec2 center = target * size;
+        const float half_width = 0.0025f * dims.x;
+        const float radius = 0.02f * dims.x;
+        const vec3 overlay_color(255.0f, 204.0f, 204.0f);
+
+        parallel_for(dims.y, 32, [&](uint32_t begin, uint32_t end) {
+            for (uint32_t row = begin; row < end; ++row) {
+                u8vec3* dst = frame.data() + row * stride + xoffset;
+                float const* src = image.data() + row * dims.x;
+                for (uint32_t col = col0; col < col1; ++col, ++dst) {
+                    const float t = clamp(255.0f * (0.5f + scale * src[col]), 0.0f, 255.0f);
+                    *dst = palette[uint8_t(t)];
+                    if (!overlay) {
+                        continue;
+                    }
+                    const vec2 p = vec2(col, row) + 0.5f;
+                    const float h = clamp(dot(p - a, b - a) / dot(b - a, b - a), 0.0f, 1.0f);
+                    const float dline = length(p - a - h * (b - a));
+                    const float dcircle = abs(length(p - center) - radius);
+                    const float coverage = clamp(half_width + 0.5f - min(dline, dcircle), 0.f, 1.f);
+                    const float alpha = 0.15f * coverage;
+                    *dst = mix(vec3(*dst), overlay_color, alpha);
+                }
+            }
+        });
+    };
+
+    colorize(view_image, 0, true);
+    colorize(tile_image, cropped, false);
+}
+
+bool IslandZoom::exec(vector<string> vargs) {
+    if (vargs.size() != 3) {
+        fmt::print("This command takes 3 arguments.\n");
+        return false;
+    }
+    const string dimstring = vargs[0];
+    const uint32_t nframes = atoi(vargs[1].c_str());
+    const string output = vargs[2];
+    dims.x = atoi(dimstring.c_str());
+    dims.y = atoi(dimstring.substr(dimstring.find('x') + 1).c_str());
+
+    // Frames are either written as a raw RGB stream (to stdout if the filename is a dash) or as a
+    // series of numbered npy files, similar to advect_points.
+    const bool write_npy = output.size() > 4 && output.substr(output.size() - 4) == ".npy";
+    FILE* stream = nullptr;
+    if (!write_npy) {
+        stream = output == "-" ? stdout : fopen(output.c_str(), "wb");
+        if (!stream) {
+            fmt::print("Unable to open {}.\n", output);
+            return false;
+        }
+    }
+
+    const uint32_t npixels = dims.x * dims.y;
+    view_image.resize(npixels);
+    tile_image.resize(npixels);
+    palette = create_palette();
+    for (uint32_t row = 0; row < dims.y; ++row) {
+        const float y = hermite(-1.0f + 2.0f * row / (dims.y - 1));
+        for (uint32_t col = 0; col < dims.x; ++col) {
+            const float x = hermite(-1.0f + 2.0f * col / (dims.x - 1));
+            tile_image[row * dims.x + col] = x * y - kSeaLevel;
+        }
+    }
+
+    // Bake several layers of noise into the base tile, then animate with one layer.
+    noise_frequency = 16.0f;
+    num_layers = 4;
+    create_viewports();
+    update_view(num_layers);
+    tile_image = view_image;
+    num_layers = 1;
+    create_viewports();
+    update_view(num_layers);
+    target = marching_line(view_image, kTargetLine);
+
+    vector<u8vec3> frame;
+    for (uint32_t frameno = 0; frameno < nframes; ++frameno) {
+
+        // Draw the heightmap for the current viewport.
+        update_view(num_layers);
+
+        // Recompute the point of interest.
+        target = marching_line(view_image, kTargetLine);
+
+        // Draw the overlay and convert the heightmap into color.
+        render_view(frame);
+        const uint32_t width = frame.size() / dims.y;
+        if (write_npy) {
+            const string filename = fmt::format("{:03}{}", frameno, output);
+            cnpy::npy_save(filename, &frame.data()->x, {dims.y, width, 3}, "w");
+        } else {
+            fwrite(frame.data(), sizeof(u8vec3), frame.size(), stream);
+        }
+
+        // Compute the pan / zoom adjustments for the largest viewport and propagate the movement
+        // to all layer viewports.
+        vec4 vpdelta = shrink_viewport(viewports.back());
+        for (auto vp = viewports.rbegin(); vp != viewports.rend(); ++vp) {
+            *vp += vpdelta;
+            vpdelta /= 2;
+        }
+
+        // If the largest viewport is sufficiently small, it's time to increment zoom.
+        const vec4 vp = viewports.back();
+        if (vp.z - vp.x < 0.5f && vp.w - vp.y < 0.5f) {
+            update_tile();
+        }
+    }
+
+    if (stream && stream != stdout) {
+        fclose(stream);
+    }
+    const uint32_t width = frame.size() / std::max(dims.y, 1u);
+    fmt::print(stderr, "Generated {} frames of {}x{} RGB.\n", nframes, width, dims.y);
+    return true;
+}
+
+} // anonymous namespace
@@ -0,0 +1,300 @@
+#include "clumpy_command.hh"
+#include "clumpy_parallel.hh"
+#include "fmt/core.h"
+#include "cnpy/cnpy.h"
+#include "blob/blob.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <numeric>
+
+using std::vector;
+using std::string;
+
+namespace {
+
+struct LabelComponents : ClumpyCommand {
+    LabelComponents() {}
+    bool exec(vector<string> args) override;
+    string description() const override {
+        return "label connected components and measure their area, bounds and centroid";
+    }
+    string usage() const override {
+        return "<input_img> <output_labels> <output_stats> [threshold=0] [select=below]";
+    }
+    string example() const override {
+        return "heights.npy labels.npy islands.npy threshold=0.1 select=above";
+    }
+};
+
+static ClumpyCommand::Register registrar("label_components", [] {
+    return new LabelComponents();
+});
+
+// Tiles are small enough that blob's 16-bit labels cannot overflow, since an 8-connected tile has
+// at most one component per 2x2 block.
+constexpr uint32_t TileSize = 256;
+
+struct Stats {
+    uint64_t first;  // raster index of the first pixel
+    uint64_t area;
+    double sumx, sumy;
+    uint32_t xmin, ymin, xmax, ymax;
+
+    void merge(Stats const& other) {
+        first = std::min(first, other.first);
+        area += other.area;
+        sumx += other.sumx;
+        sumy += other.sumy;
+        xmin = std::min(xmin, other.xmin);
+        ymin = std::min(ymin, other.ymin);
+        xmax = std::max(xmax, other.xmax);
+        ymax = std::max(ymax, other.ymax);
+    }
+};
+
+struct Tile {
+    uint32_t left, top, width, height;
+    uint32_t offset;  // global index of the tile's first component
+    vector<Stats> stats;
+};
+
+struct UnionFind {
+    vector<uint32_t> parent;
+    explicit UnionFind(uint32_t count) : parent(count) {
+        std::iota(parent.begin(), parent.end(), 0);
+    }
+    uint32_t find(uint32_t i) {
+        while (parent[i] != i) {
+            i = parent[i] = parent[parent[i]];
+        }
+        return i;
+    }
+    void unite(uint32_t a, uint32_t b) {
+        a = find(a);
+        b = find(b);
+        if (a < b) parent[b] = a;
+        if (b < a) parent[a] = b;
+    }
+};
+
+// Labels one tile with blob, writing 1-based local labels into the full label image and gathering
+// per-component statistics. The tile is copied into its own buffer because blob takes 16-bit
+// dimensions and strides.
+bool label_tile(vector<uint8_t> const& mask, uint32_t width, Tile* tile, uint32_t* labels) {
+    vector<uint8_t> buffer(tile->width * tile->height);
+    for (uint32_t row = 0; row < tile->height; ++row) {
+        uint8_t const* src = mask.data() + uint64_t(tile->top + row) * width + tile->left;
+        std::copy(src, src + tile->width, buffer.data() + row * tile->width);
+    }
+
+    label_t* local;
+    int16_t label_width, label_height;
+    blob_t* blobs;
+    int count;
+    if (!find_blobs(0, 0, tile->width, tile->height, buffer.data(), tile->width, tile->height,
+            &local, &label_width, &label_height, &blobs, &count, 0)) {
+        return false;
+    }
+    destroy_blobs(blobs, count);
+    if (count == 0) {
+        free(local);
+        return true;
+    }
+
+    Stats empty = {};
+    empty.first = UINT64_MAX;
+    empty.xmin = empty.ymin = UINT32_MAX;
+    tile->stats.assign(count, empty);
+    for (uint32_t row = 0; row < tile->height; ++row) {
+        const uint32_t y = tile->top + row;
+        for (uint32_t col = 0; col < tile->width; ++col) {
+            const uint32_t x = tile->left + col;
+            const label_t label = buffer[row * tile->width + col] ?
+                    local[row * tile->width + col] : 0;
+            labels[uint64_t(y) * width + x] = std::max<label_t>(label, 0);
+            if (label <= 0) continue;
+            Stats& stats = tile->stats[label - 1];
+            stats.first = std::min(stats.first, uint64_t(y) * width + x);
+            stats.area++;
+            stats.sumx += x;
+            stats.sumy += y;
+            stats.xmin = std::min(stats.xmin, x);
+            stats.ymin = std::min(stats.ymin, y);
+            stats.xmax = std::max(stats.xmax, x);
+            stats.ymax = std::max(stats.ymax, y);
+        }
+    }
+    free(local);
+    return true;
+}
+
+// Finds 8-connected components of the selected pixels. Tiles are labeled in parallel with the
+// contour tracing algorithm of Chang et al., then components that touch across tile seams are
+// merged with union-find. Labels are numbered from 1 in raster order of each component's first
+// pixel, so the result does not depend on the tiling. Background pixels are 0.
+//
+// For float input, pixels are selected where they are at or below the threshold, which for an SDF
+// is the inside, or where they are above it if select=above, which for a heightmap is the land.
+// For uint8 input, non-zero pixels are selected.
+//
+// The stats output has one row per component: area in pixels, the inclusive bounding box as
+// xmin, ymin, xmax, ymax, and the centroid x, y.
+bool LabelComponents::exec(vector<string> vargs) {
+    Options options = extract_options(vargs);
+    if (!check_options(options, {"threshold", "select"})) {
+        return false;
+    }
+    if (vargs.size() != 3) {
+        fmt::print("This command takes 3 arguments.\n");
+        return false;
+    }
+    const string input_file = vargs[0];
+    const string labels_file = vargs[1];
+    const string stats_file = vargs[2];
+    const float threshold = options.count("threshold") ? atof(options["threshold"].c_str()) : 0;
+    const string select = options.count("select") ? options["select"] : "below";
+    if (select != "below" && select != "above") {
+        fmt::print("Select must be below/above.\n");
+        return false;
+    }
+
+    cnpy::NpyArray arr = cnpy::npy_load(input_file);
+    if (arr.shape.size() != 2) {
+        fmt::print("Input data has wrong shape.\n");
+        return false;
+    }
+    const uint32_t height = arr.shape[0];
+    const uint32_t width = arr.shape[1];
+    const uint64_t npixels = uint64_t(width) * height;
+
+    vector<uint8_t> mask(npixels);
+    if (arr.word_size == sizeof(float) && arr.type_code == 'f') {
+        float const* src = arr.data<float>();
+        for (uint64_t i = 0; i < npixels; ++i) {
+            mask[i] = select == "below" ? src[i] <= threshold : src[i] > threshold;
+        }
+    } else if (arr.word_size == sizeof(uint8_t) && arr.type_code == 'u') {
+        uint8_t const* src = arr.data<uint8_t>();
+        for (uint64_t i = 0; i < npixels; ++i) {
+            mask[i] = src[i] != 0;
+        }
+    } else {
+        fmt::print("Input data must be float32 or uint8.\n");
+        return false;
+    }
+
+    const uint32_t ncols = (width + TileSize - 1) / TileSize;
+    const uint32_t nrows = (height + TileSize - 1) / TileSize;
+    vector<Tile> tiles(ncols * nrows);
+    for (uint32_t i = 0; i < tiles.size(); ++i) {
+        Tile& tile = tiles[i];
+        tile.left = (i % ncols) * TileSize;
+        tile.top = (i / ncols) * TileSize;
+        tile.width = std::min(TileSize, width - tile.left);
+        tile.height = std::min(TileSize, height - tile.top);
+    }
+
+    vector<uint32_t> labels(npixels);
+    vector<uint8_t> success(tiles.size());
+    parallel_for(tiles.size(), 1, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; ++i) {
+            success[i] = label_tile(mask, width, &tiles[i], labels.data());
+        }
+    });
+    if (std::count(success.begin(), success.end(), 0)) {
+        fmt::print("Unable to label tiles.\n");
+        return false;
+    }
+
+    uint32_t nlocal = 0;
+    for (auto& tile : tiles) {
+        tile.offset = nlocal;
+        nlocal += tile.stats.size();
+    }
+    auto global = [&](uint32_t x, uint32_t y) {
+        const uint32_t label = labels[uint64_t(y) * width + x];
+        return tiles[(y / TileSize) * ncols + x / TileSize].offset + label - 1;
+    };
+
+    // Merge 8-connected neighbors across each horizontal seam, then each vertical seam.
+    UnionFind components(nlocal);
+    for (uint32_t y = TileSize; y < height; y += TileSize) {
+        for (uint32_t x = 0; x < width; ++x) {
+            if (!labels[uint64_t(y - 1) * width + x]) continue;
+            for (uint32_t nx = x > 0 ? x - 1 : 0; nx <= std::min(x + 1, width - 1); ++nx) {
+                if (labels[uint64_t(y) * width + nx]) {
+                    components.unite(global(x, y - 1), global(nx, y));
+                }
+            }
+        }
+    }
+    for (uint32_t x = TileSize; x < width; x += TileSize) {
+        for (uint32_t y = 0; y < height; ++y) {
+            if (!labels[uint64_t(y) * width + x - 1]) continue;
+            for (uint32_t ny = y > 0 ? y - 1 : 0; ny <= std::min(y + 1, height - 1); ++ny) {
+                if (labels[uint64_t(ny) * width + x]) {
+                    components.unite(global(x - 1, y), global(x, ny));
+                }
+            }
+        }
+    }
+
+    // Gather statistics into each root, then number the roots by their first pixel.
+    vector<Stats> merged(nlocal);
+    vector<uint32_t> roots;
+    for (auto const& tile : tiles) {
+        for (uint32_t i = 0; i < tile.stats.size(); ++i) {
+            const uint32_t root = components.find(tile.offset + i);
+            if (root == tile.offset + i) {
+                merged[root] = tile.stats[i];
+                roots.push_back(root);
+            } else {
+                merged[root].merge(tile.stats[i]);
+            }
+        }
+    }
+    std::sort(roots.begin(), roots.end(), [&merged](uint32_t a, uint32_t b) {
+        return merged[a].first < merged[b].first;
+    });
+    vector<uint32_t> final_label(nlocal);
+    for (uint32_t i = 0; i < roots.size(); ++i) {
+        final_label[roots[i]] = i + 1;
+    }
+    for (uint32_t i = 0; i < nlocal; ++i) {
+        final_label[i] = final_label[components.find(i)];
+    }
+
+    parallel_for(tiles.size(), 1, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; ++i) {
+            Tile const& tile = tiles[i];
+            for (uint32_t y = tile.top; y < tile.top + tile.height; ++y) {
+                uint32_t* row = labels.data() + uint64_t(y) * width;
+                for (uint32_t x = tile.left; x < tile.left + tile.width; ++x) {
+                    if (row[x]) row[x] = final_label[tile.offset + row[x] - 1];
+                }
+            }
+        }
+    });
+
+    const uint32_t ncomponents = roots.size();
+    vector<float> stats(ncomponents * 7);
+    for (uint32_t i = 0; i < ncomponents; ++i) {
+        Stats const& s = merged[roots[i]];
+        float* dst = stats.data() + i * 7;
+        dst[0] = s.area;
+        dst[1] = s.xmin;
+        dst[2] = s.ymin;
+        dst[3] = s.xmax;
+        dst[4] = s.ymax;
+        dst[5] = s.sumx / s.area;
+        dst[6] = s.sumy / s.area;
+    }
+
+    fmt::print("Found {} components.\n", ncomponents);
+    cnpy::npy_save(labels_file, labels.data(), {height, width}, "w");
+    cnpy::npy_save(stats_file, stats.data(), {ncomponents, 7}, "w");
+    return true;
+}
+
+} // anonymous namespace
@@ -0,0 +1,336 @@
+#include "clumpy_command.hh"
+#include "clumpy_parallel.hh"
+#include "fmt/core.h"
+#include "cnpy/cnpy.h"
+
+#include <glm/vec2.hpp>
+#include <glm/ext.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <unordered_map>
+
+using namespace glm;
+
+using std::vector;
+using std::string;
+
+void splat_disks(vec2 const* ptlist, uint32_t npts, u32vec2 dims, uint8_t* dstimg, float alpha,
+        int kernel_size);
+
+namespace {
+
+struct PlaceStreamlines : ClumpyCommand {
+    PlaceStreamlines() {}
+    bool exec(vector<string> args) override;
+    string description() const override {
+        return "create evenly spaced streamlines with the Jobard-Lefer method";
+    }
+    string usage() const override {
+        return "<velocities_img> <line_width> <separating_distance> <output_img> <output_pts> "
+                "<output_offsets> [step=0.5] [test_ratio=0.5] [min_length=0]";
+    }
+    string example() const override {
+        return "speeds.npy 3 12 streamlines.npy lines.npy offsets.npy";
+    }
+};
+
+static ClumpyCommand::Register registrar("place_streamlines", [] {
+    return new PlaceStreamlines();
+});
+
+// Number of seeds whose streamlines are integrated concurrently.
+constexpr uint32_t BatchSize = 64;
+
+struct VelocityField {
+    uint32_t width, height;
+    vec2 const* data;
+
+    bool contains(vec2 p) const {
+        return p.x >= 0 && p.y >= 0 && p.x <= width - 1 && p.y <= height - 1;
+    }
+
+    // Bilinear sample at a point in pixel coordinates, which must be within the field.
+    vec2 sample(vec2 p) const {
+        const uint32_t x = std::min(uint32_t(p.x), width - 2);
+        const uint32_t y = std::min(uint32_t(p.y), height - 2);
+        const vec2 f = p - vec2(x, y);
+        vec2 const* row = data + y * width + x;
+        const vec2 top = mix(row[0], row[1], f.x);
+        const vec2 bottom = mix(row[width], row[width + 1], f.x);
+        return mix(top, bottom, f.y);
+    }
+
+    // Unit direction of the flow, or false where the flow stops or leaves the field.
+    bool direction(vec2 p, float sign, vec2* result) const {
+        if (!contains(p)) return false;
+        const vec2 v = sample(p);
+        const float speed = length(v);
+        if (!(speed > 1e-12f)) return false;
+        *result = v * (sign / speed);
+        return true;
+    }
+
+    // Takes one fourth-order Runge-Kutta step along the normalized flow.
+    bool step(vec2* p, float h, float sign) const {
+        vec2 k1, k2, k3, k4;
+        if (!direction(*p, sign, &k1) ||
+                !direction(*p + 0.5f * h * k1, sign, &k2) ||
+                !direction(*p + 0.5f * h * k2, sign, &k3) ||
+                !direction(*p + h * k3, sign, &k4)) {
+            return false;
+        }
+        const vec2 next = *p + (h / 6.0f) * (k1 + 2.0f * k2 + 2.0f * k3 + k4);
+        if (!contains(next)) return false;
+        *p = next;
+        return true;
+    }
+};
+
+// Uniform grid of streamline samples with cells as large as the separating distance, so that
+// proximity queries up to that distance only visit the 3x3 neighborhood of a cell.
+struct SampleGrid {
+    float cell_size;
+    uint32_t ncols, nrows;
+    vector<vector<vec2>> cells;
+
+    SampleGrid(uint32_t width, uint32_t height, float cell) : cell_size(cell),
+            ncols(uint32_t(width / cell) + 1), nrows(uint32_t(height / cell) + 1),
+            cells(ncols * nrows) {}
+
+    void insert(vec2 p) {
+        cells[uint32_t(p.y / cell_size) * ncols + uint32_t(p.x / cell_size)].push_back(p);
+    }
+
+    // Returns true if any sample is closer than the given distance.
+    bool near(vec2 p, float distance) const {
+        const int col = p.x / cell_size;
+        const int row = p.y / cell_size;
+        const float d2 = distance * distance;
+        for (int j = std::max(row - 1, 0); j <= std::min(row + 1, int(nrows) - 1); ++j) {
+            for (int i = std::max(col - 1, 0); i <= std::min(col + 1, int(ncols) - 1); ++i) {
+                for (vec2 q : cells[j * ncols + i]) {
+                    if (dot(p - q, p - q) < d2) return true;
+                }
+            }
+        }
+        return false;
+    }
+};
+
+// Samples of the streamline being traced, used to stop it when it loops back onto itself. Samples
+// are indexed by arc length in steps from the seed, negative when traced backwards, and those
+// fewer than gap steps away along the line are ignored.
+struct SelfGrid {
+    float cell_size;
+    int gap;
+    std::unordered_map<uint64_t, vector<std::pair<vec2, int>>> cells;
+
+    uint64_t key(int col, int row) const {
+        return (uint64_t(uint32_t(row)) << 32) | uint32_t(col);
+    }
+
+    void insert(vec2 p, int index) {
+        cells[key(p.x / cell_size, p.y / cell_size)].push_back({p, index});
+    }
+
+    bool near(vec2 p, int index, float distance) const {
+        const int col = p.x / cell_size;
+        const int row = p.y / cell_size;
+        const float d2 = distance * distance;
+        for (int j = row - 1; j <= row + 1; ++j) {
+            for (int i = col - 1; i <= col + 1; ++i) {
+                auto cell = cells.find(key(i, j));
+                if (cell == cells.end()) continue;
+                for (auto const& sample : cell->second) {
+                    if (std::abs(sample.second - index) > gap &&
+                            dot(p - sample.first, p - sample.first) < d2) {
+                        return true;
+                    }
+                }
+            }
+        }
+        return false;
+    }
+};
+
+struct Settings {
+    float separation;
+    float test_distance;
+    float step;
+    uint32_t max_steps;
+};
+
+// Integrates forward and backward from the seed until the line leaves the field, reaches a
+// stagnation point, or comes within the test distance of an existing streamline or of itself.
+// The result runs from the backward end, through the seed, to the forward end.
+vector<vec2> trace(VelocityField const& field, SampleGrid const& grid, Settings const& settings,
+        vec2 seed, size_t* seed_index) {
+    SelfGrid self;
+    self.cell_size = settings.separation;
+    self.gap = int(std::ceil(2 * settings.separation / settings.step));
+    self.insert(seed, 0);
+    vector<vec2> halves[2];
+    for (int half = 0; half < 2; ++half) {
+        const float sign = half == 0 ? -1 : +1;
+        vec2 p = seed;
+        for (uint32_t i = 1; i <= settings.max_steps; ++i) {
+            if (!field.step(&p, settings.step, sign)) break;
+            const int index = half == 0 ? -int(i) : int(i);
+            if (grid.near(p, settings.test_distance)) break;
+            if (self.near(p, index, settings.test_distance)) break;
+            self.insert(p, index);
+            halves[half].push_back(p);
+        }
+    }
+    vector<vec2> line(halves[0].rbegin(), halves[0].rend());
+    *seed_index = line.size();
+    line.push_back(seed);
+    line.insert(line.end(), halves[1].begin(), halves[1].end());
+    return line;
+}
+
+// Evenly spaced streamline placement by Jobard and Lefer. Each accepted streamline offers seed
+// candidates at the separating distance on both sides, and a candidate is traced only if no
+// streamline is closer than that distance. When the queue runs dry, a lattice of seeds with the
+// same spacing covers regions that the existing streamlines do not reach. Lines stop at the test
+// distance, which is the separating distance times test_ratio.
+//
+// Seeds are traced in parallel batches against the grid as it was before the batch, then accepted
+// in order. Each accepted line is trimmed to the points around its seed that are still clear of
+// the lines accepted earlier in the same batch, so the result does not depend on the number of
+// threads.
+//
+// The velocities are sampled bilinearly at full resolution, and lines are integrated with RK4 at a
+// fixed step in pixels. The output image is the streamlines drawn with disks of the given width.
+// The polylines are in pixels, in the layout used by extract_contours and export_svg. Lines shorter
+// than min_length pixels are discarded.
+bool PlaceStreamlines::exec(vector<string> vargs) {
+    Options options = extract_options(vargs);
+    if (!check_options(options, {"step", "test_ratio", "min_length"})) {
+        return false;
+    }
+    if (vargs.size() != 6) {
+        fmt::print("This command takes 6 arguments.\n");
+        return false;
+    }
+    const string velocities_img = vargs[0];
+    const int line_width = atoi(vargs[1].c_str());
+    const float separation = atof(vargs[2].c_str());
+    const string output_img = vargs[3];
+    const string output_pts = vargs[4];
+    const string output_offsets = vargs[5];
+    const float step = options.count("step") ? atof(options["step"].c_str()) : 0.5f;
+    const float test_ratio = options.count("test_ratio") ?
+            atof(options["test_ratio"].c_str()) : 0.5f;
+    const float min_length = options.count("min_length") ?
+            atof(options["min_length"].c_str()) : 0;
+    if (line_width < 1 || 0 == (line_width % 2)) {
+        fmt::print("Line width must be an odd integer.\n");
+        return false;
+    }
+    if (!(separation > 0) || !(step > 0) || !(test_ratio > 0 && test_ratio <= 1)) {
+        fmt::print("Separation and step must be positive, and test_ratio must be in (0, 1].\n");
+        return false;
+    }
+
+    cnpy::NpyArray img = cnpy::npy_load(velocities_img);
+    if (img.shape.size() != 3 || img.shape[2] != 2) {
+        fmt::print("Velocities have wrong shape.\n");
+        return false;
+    }
+    if (img.word_size != sizeof(float) || img.type_code != 'f') {
+        fmt::print("Velocities have wrong data type.\n");
+        return false;
+    }
+    VelocityField field;
+    field.width = img.shape[1];
+    field.height = img.shape[0];
+    field.data = img.data<vec2>();
+    if (field.width < 2 || field.height < 2) {
+        fmt::print("Velocities must be at least 2x2.\n");
+        return false;
+    }
+
+    Settings settings;
+    settings.separation = separation;
+    settings.test_distance = separation * test_ratio;
+    settings.step = step;
+    settings.max_steps = uint32_t(4 * (field.width + field.height) / step);
+
+    SampleGrid grid(field.width, field.height, separation);
+    std::deque<vec2> candidates;
+    uint32_t lattice_index = 0;
+    const uint32_t lattice_cols = uint32_t((field.width - 1) / separation) + 1;
+    const uint32_t lattice_rows = uint32_t((field.height - 1) / separation) + 1;
+    auto valid = [&](vec2 seed) {
+        vec2 dir;
+        return field.direction(seed, 1, &dir) && !grid.near(seed, separation);
+    };
+
+    vector<vec2> points;
+    vector<uint32_t> offsets;
+    vector<vec2> batch;
+    vector<vector<vec2>> lines;
+    vector<size_t> seeds;
+    while (true) {
+        batch.clear();
+        while (batch.size() < BatchSize && !candidates.empty()) {
+            if (valid(candidates.front())) batch.push_back(candidates.front());
+            candidates.pop_front();
+        }
+        while (batch.empty() && lattice_index < lattice_cols * lattice_rows) {
+            const uint32_t i = lattice_index++;
+            const vec2 seed = separation * (vec2(i % lattice_cols, i / lattice_cols) + 0.5f);
+            if (valid(seed)) batch.push_back(seed);
+        }
+        if (batch.empty()) break;
+
+        lines.resize(batch.size());
+        seeds.resize(batch.size());
+        parallel_for(batch.size(), 1, [&](uint32_t begin, uint32_t end) {
+            for (uint32_t i = begin; i < end; ++i) {
+                lines[i] = trace(field, grid, settings, batch[i], &seeds[i]);
+            }
+        });
+
+        for (uint32_t i = 0; i < batch.size(); ++i) {
+            if (grid.near(batch[i], separation)) continue;
+            vector<vec2> const& line = lines[i];
+            size_t first = seeds[i], last = seeds[i];
+            while (first > 0 && !grid.near(line[first - 1], settings.test_distance)) --first;
+            while (last + 1 < line.size() && !grid.near(line[last + 1], settings.test_distance)) {
+                ++last;
+            }
+            if (last == first || (last - first) * step < min_length) continue;
+
+            offsets.push_back(points.size());
+            for (size_t j = first; j <= last; ++j) {
+                points.push_back(line[j]);
+                grid.insert(line[j]);
+            }
+
+            // Offer seeds on both sides, about every half separation along the line.
+            const size_t stride = std::max(1u, uint32_t(0.5f * separation / step));
+            for (size_t j = first; j <= last; j += stride) {
+                const vec2 tangent = line[std::min(j + 1, last)] - line[j > first ? j - 1 : j];
+                if (length(tangent) == 0) continue;
+                const vec2 normal = normalize(vec2(-tangent.y, tangent.x)) * separation;
+                candidates.push_back(line[j] + normal);
+                candidates.push_back(line[j] - normal);
+            }
+        }
+    }
+    fmt::print("{} streamlines, {} points.\n", offsets.size(), points.size());
+
+    const u32vec2 dims(field.width, field.height);
+    vector<uint8_t> dstimg(field.width * field.height);
+    splat_disks(points.data(), points.size(), dims, dstimg.data(), 1.0f, line_width);
+    cnpy::npy_save(output_img, dstimg.data(), {field.height, field.width}, "w");
+    cnpy::npy_save(output_pts, &points.data()->x, {points.size(), 2}, "w");
+    cnpy::npy_save(output_offsets, offsets.data(), {offsets.size()}, "w");
+    return true;
+}
+
+} // anonymous namespace
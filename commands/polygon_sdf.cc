@@ -0,0 +1,336 @@
+#include "clumpy_command.hh"
+#include "clumpy_parallel.hh"
+#include "fmt/core.h"
+#include "cnpy/cnpy.h"
+
+#include <glm/vec2.hpp>
+#include <glm/ext.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using namespace glm;
+
+using std::vector;
+using std::string;
+using std::numeric_limits;
+
+// Reads a 1D array of 32-bit or 64-bit ring offsets. Signed arrays are read as signed, and
+// negative offsets are rejected. Also used by export_svg.
+bool load_offsets(string const& filename, vector<uint64_t>* offsets) {
+    cnpy::NpyArray arr = cnpy::npy_load(filename);
+    if (arr.shape.size() != 1 || (arr.type_code != 'i' && arr.type_code != 'u') ||
+            (arr.word_size != 4 && arr.word_size != 8)) {
+        return false;
+    }
+    offsets->resize(arr.shape[0]);
+    for (size_t i = 0; i < arr.shape[0]; ++i) {
+        if (arr.type_code == 'u') {
+            (*offsets)[i] = arr.word_size == 4 ? arr.data<uint32_t>()[i] : arr.data<uint64_t>()[i];
+            continue;
+        }
+        const int64_t value = arr.word_size == 4 ? arr.data<int32_t>()[i] : arr.data<int64_t>()[i];
+        if (value < 0) {
+            return false;
+        }
+        (*offsets)[i] = value;
+    }
+    return true;
+}
+
+namespace {
+
+struct PolygonSdf : ClumpyCommand {
+    PolygonSdf() {}
+    bool exec(vector<string> args) override;
+    string description() const override {
+        return "generate signed distance field of polygons or polylines";
+    }
+    string usage() const override {
+        return "<dims> <vertices_npy> <offsets_npy> <output_img> [mode=polygon] [width=0] "
+                "[tile=0,0,w,h]";
+    }
+    string example() const override {
+        return "1024x512 coast.npy rings.npy coast_sdf.npy";
+    }
+};
+
+static ClumpyCommand::Register registrar("polygon_sdf", [] {
+    return new PolygonSdf();
+});
+
+struct Segment {
+    vec2 a, b;
+};
+
+// Bounding volume hierarchy over segments. Interior nodes store their right child, and their left
+// child immediately follows them. Leaves store a range of segments.
+struct BvhNode {
+    vec2 lo, hi;
+    uint32_t first;
+    uint32_t count;
+    uint32_t right;
+};
+
+constexpr uint32_t LeafSize = 4;
+
+struct SegmentBvh {
+    vector<Segment> segments;
+    vector<BvhNode> nodes;
+    explicit SegmentBvh(vector<Segment> segs);
+    float nearest(vec2 p, float bound) const;
+    void crossings(float y, vector<vec2>* result) const;
+private:
+    uint32_t build(uint32_t first, uint32_t count);
+};
+
+SegmentBvh::SegmentBvh(vector<Segment> segs) : segments(std::move(segs)) {
+    nodes.reserve(2 * segments.size() / LeafSize + 1);
+    build(0, segments.size());
+}
+
+// Splits at the median centroid along the longer axis of the centroid bounds.
+uint32_t SegmentBvh::build(uint32_t first, uint32_t count) {
+    const uint32_t index = nodes.size();
+    nodes.emplace_back();
+    vec2 lo(numeric_limits<float>::max()), hi(numeric_limits<float>::lowest());
+    vec2 clo = lo, chi = hi;
+    for (uint32_t i = first; i < first + count; ++i) {
+        Segment const& s = segments[i];
+        lo = min(lo, min(s.a, s.b));
+        hi = max(hi, max(s.a, s.b));
+        const vec2 c = (s.a + s.b) * 0.5f;
+        clo = min(clo, c);
+        chi = max(chi, c);
+    }
+    nodes[index].lo = lo;
+    nodes[index].hi = hi;
+    if (count <= LeafSize) {
+        nodes[index].first = first;
+        nodes[index].count = count;
+        return index;
+    }
+    const int axis = chi.x - clo.x >= chi.y - clo.y ? 0 : 1;
+    const uint32_t half = count / 2;
+    std::nth_element(segments.begin() + first, segments.begin() + first + half,
+            segments.begin() + first + count, [axis](Segment const& s, Segment const& t) {
+        return s.a[axis] + s.b[axis] < t.a[axis] + t.b[axis];
+    });
+    build(first, half);
+    const uint32_t right = build(first + half, count - half);
+    nodes[index].count = 0;
+    nodes[index].right = right;
+    return index;
+}
+
+float box_distance2(vec2 p, BvhNode const& node) {
+    const vec2 d = max(max(node.lo - p, p - node.hi), vec2(0));
+    return dot(d, d);
+}
+
+float segment_distance2(vec2 p, Segment const& s) {
+    const vec2 ab = s.b - s.a;
+    const vec2 ap = p - s.a;
+    const float len2 = dot(ab, ab);
+    const float t = len2 > 0 ? clamp(dot(ap, ab) / len2, 0.0f, 1.0f) : 0.0f;
+    const vec2 d = ap - t * ab;
+    return dot(d, d);
+}
+
+// Returns the distance from p to the nearest segment, or the bound if no segment is closer. Nodes
+// are visited nearest first and skipped once their boxes are farther than the best distance.
+float SegmentBvh::nearest(vec2 p, float bound) const {
+    float best2 = bound * bound;
+    uint32_t stack[64];
+    uint32_t depth = 0;
+    stack[depth++] = 0;
+    while (depth > 0) {
+        BvhNode const& node = nodes[stack[--depth]];
+        if (box_distance2(p, node) >= best2) continue;
+        if (node.count > 0) {
+            for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+                best2 = std::min(best2, segment_distance2(p, segments[i]));
+            }
+            continue;
+        }
+        const uint32_t left = &node - nodes.data() + 1;
+        const float dleft = box_distance2(p, nodes[left]);
+        const float dright = box_distance2(p, nodes[node.right]);
+        if (dleft < dright) {
+            stack[depth++] = node.right;
+            stack[depth++] = left;
+        } else {
+            stack[depth++] = left;
+            stack[depth++] = node.right;
+        }
+    }
+    return std::sqrt(best2);
+}
+
+// Finds every segment that crosses the horizontal line at y, using the half-open rule so that
+// shared vertices are counted once. Each result is the crossing's x coordinate and its winding
+// direction, +1 for upward segments and -1 for downward ones.
+void SegmentBvh::crossings(float y, vector<vec2>* result) const {
+    result->clear();
+    uint32_t stack[64];
+    uint32_t depth = 0;
+    stack[depth++] = 0;
+    while (depth > 0) {
+        BvhNode const& node = nodes[stack[--depth]];
+        if (y < node.lo.y || y > node.hi.y) continue;
+        if (node.count > 0) {
+            for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+                Segment const& s = segments[i];
+                if ((s.a.y <= y) == (s.b.y <= y)) continue;
+                const float t = (y - s.a.y) / (s.b.y - s.a.y);
+                result->emplace_back(s.a.x + t * (s.b.x - s.a.x), s.a.y <= y ? 1 : -1);
+            }
+            continue;
+        }
+        stack[depth++] = &node - nodes.data() + 1;
+        stack[depth++] = node.right;
+    }
+    std::sort(result->begin(), result->end(), [](vec2 a, vec2 b) { return a.x < b.x; });
+}
+
+// Vertices are an Nx2 array of float32 or float64 pixel coordinates, where the center of pixel
+// (col, row) is at (col, row). The offsets are the index of the first vertex of each ring. A final
+// offset equal to the vertex count is optional.
+//
+// In polygon mode, each ring is closed, and pixels are inside where the total winding number of all
+// rings is non-zero, so holes are rings of opposite orientation. In polyline mode, rings are open
+// chains, and the field is the distance to the nearest chain minus half the width, which is in
+// pixels like the vertices.
+//
+// The output is negative inside, in the units of generate_dshapes where the shorter image dimension
+// spans 1.0. Rows are evaluated in parallel. Each pixel starts its nearest-segment search from the
+// previous pixel's distance plus one, which is a valid bound because distance is 1-Lipschitz.
+bool PolygonSdf::exec(vector<string> vargs) {
+    Options options = extract_options(vargs);
+    if (!check_options(options, {"mode", "width", "tile"})) {
+        return false;
+    }
+    if (vargs.size() != 4) {
+        fmt::print("This command takes 4 arguments.\n");
+        return false;
+    }
+    const string dims = vargs[0];
+    const uint32_t width = atoi(dims.c_str());
+    const uint32_t height = atoi(dims.substr(dims.find('x') + 1).c_str());
+    const string vertices_file = vargs[1];
+    const string offsets_file = vargs[2];
+    const string output_file = vargs[3];
+    const string mode = options.count("mode") ? options["mode"] : "polygon";
+    const float line_width = options.count("width") ? atof(options["width"].c_str()) : 0;
+    if (mode != "polygon" && mode != "polyline") {
+        fmt::print("Mode must be polygon/polyline.\n");
+        return false;
+    }
+    const bool closed = mode == "polygon";
+
+    uint32_t tile[4] = {0, 0, width, height};
+    if (options.count("tile")) {
+        string tuple = options["tile"];
+        for (int i = 0; i < 4; ++i) {
+            tile[i] = atoi(tuple.c_str());
+            tuple = tuple.substr(tuple.find(',') + 1);
+        }
+        if (tile[2] == 0 || tile[3] == 0 || tile[0] + tile[2] > width ||
+                tile[1] + tile[3] > height) {
+            fmt::print("Tile must be a non-empty region within the image.\n");
+            return false;
+        }
+    }
+
+    cnpy::NpyArray arr = cnpy::npy_load(vertices_file);
+    if (arr.shape.size() != 2 || arr.shape[1] != 2) {
+        fmt::print("Vertices have wrong shape.\n");
+        return false;
+    }
+    const size_t nverts = arr.shape[0];
+    vector<vec2> vertices(nverts);
+    if (arr.word_size == sizeof(float) && arr.type_code == 'f') {
+        std::copy(arr.data<vec2>(), arr.data<vec2>() + nverts, vertices.begin());
+    } else if (arr.word_size == sizeof(double) && arr.type_code == 'f') {
+        for (size_t i = 0; i < nverts; ++i) {
+            vertices[i] = vec2(arr.data<dvec2>()[i]);
+        }
+    } else {
+        fmt::print("Vertices must be float32 or float64.\n");
+        return false;
+    }
+
+    vector<uint64_t> offsets;
+    if (!load_offsets(offsets_file, &offsets)) {
+        fmt::print("Offsets must be a 1D array of non-negative 32-bit or 64-bit integers.\n");
+        return false;
+    }
+    if (offsets.empty() || offsets.back() != nverts) {
+        offsets.push_back(nverts);
+    }
+
+    vector<Segment> segments;
+    const size_t min_ring = closed ? 3 : 2;
+    for (size_t ring = 0; ring + 1 < offsets.size(); ++ring) {
+        const size_t first = offsets[ring];
+        const size_t last = offsets[ring + 1];
+        if (first > last || last > nverts || last - first < min_ring) {
+            fmt::print("Ring {} must have at least {} vertices.\n", ring, min_ring);
+            return false;
+        }
+        for (size_t i = first; i + 1 < last; ++i) {
+            segments.push_back({vertices[i], vertices[i + 1]});
+        }
+        if (closed) {
+            segments.push_back({vertices[last - 1], vertices[first]});
+        }
+    }
+    if (segments.empty()) {
+        fmt::print("Input has no edges.\n");
+        return false;
+    }
+    const SegmentBvh bvh(std::move(segments));
+
+    const float scale = 1.0f / std::min(width, height);
+    const float infinity = numeric_limits<float>::max();
+    vector<float> result(tile[2] * tile[3]);
+    parallel_for(tile[3], 8, [&](uint32_t begin, uint32_t end) {
+        vector<vec2> crossings;
+        for (uint32_t tile_row = begin; tile_row < end; ++tile_row) {
+            const float y = tile[1] + tile_row;
+            float* pdata = result.data() + tile_row * tile[2];
+
+            // Winding number to the right of each pixel, swept from the left.
+            int winding = 0;
+            uint32_t next = 0;
+            if (closed) {
+                bvh.crossings(y, &crossings);
+                for (auto const& c : crossings) winding += c.y;
+            }
+
+            float previous = infinity;
+            for (uint32_t col = tile[0]; col < tile[0] + tile[2]; ++col, ++pdata) {
+                const vec2 p(col, y);
+                const float bound = previous < infinity ? previous + 1.0f : infinity;
+                const float distance = bvh.nearest(p, bound);
+                previous = distance;
+                if (closed) {
+                    while (next < crossings.size() && crossings[next].x <= p.x) {
+                        winding -= crossings[next++].y;
+                    }
+                    *pdata = (winding != 0 ? -distance : distance) * scale;
+                } else {
+                    *pdata = (distance - line_width * 0.5f) * scale;
+                }
+            }
+        }
+    });
+
+    const auto range = std::minmax_element(result.begin(), result.end());
+    fmt::print("SDF range is {} to {}\n", *range.first, *range.second);
+    cnpy::npy_save(output_file, result.data(), {tile[3], tile[2]}, "w");
+    return true;
+}
+
+} // anonymous namespace
@@ -0,0 +1,278 @@
+#include "clumpy_command.hh"
+#include "clumpy_parallel.hh"
+#include "fmt/core.h"
+#include "cnpy/cnpy.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using std::vector;
+using std::string;
+using std::numeric_limits;
+
+namespace {
+
+struct Redistance : ClumpyCommand {
+    Redistance() {}
+    bool exec(vector<string> args) override;
+    string description() const override {
+        return "restore a distorted signed distance field to unit gradient";
+    }
+    string usage() const override {
+        return "<input_img> <output_img> [band=0] [iterations=8]";
+    }
+    string example() const override {
+        return "potential.npy sdf.npy band=0.1";
+    }
+};
+
+static ClumpyCommand::Register registrar("redistance", [] {
+    return new Redistance();
+});
+
+constexpr float Infinity = numeric_limits<float>::max();
+
+// Distances in pixels to the zero crossing, for pixels that have a sign change with at least one
+// 4-neighbor. The crossing is found by linear interpolation along each axis, and crossings on both
+// axes are combined as the distance to the line through them. Other pixels are set to Infinity.
+void find_interface(float const* phi, uint32_t width, uint32_t height, float* dist) {
+    parallel_for(height, 16, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t row = begin; row < end; ++row) {
+            for (uint32_t col = 0; col < width; ++col) {
+                const uint32_t i = row * width + col;
+                const float p = phi[i];
+                if (p == 0) {
+                    dist[i] = 0;
+                    continue;
+                }
+                auto crossing = [&](uint32_t j) {
+                    const float q = phi[j];
+                    return (p > 0) != (q > 0) || q == 0 ? p / (p - q) : Infinity;
+                };
+                float hx = Infinity, hy = Infinity;
+                if (col > 0) hx = std::min(hx, crossing(i - 1));
+                if (col + 1 < width) hx = std::min(hx, crossing(i + 1));
+                if (row > 0) hy = std::min(hy, crossing(i - width));
+                if (row + 1 < height) hy = std::min(hy, crossing(i + width));
+                if (hx < Infinity && hy < Infinity) {
+                    dist[i] = hx * hy / std::sqrt(hx * hx + hy * hy);
+                } else {
+                    dist[i] = std::min(hx, hy);
+                }
+            }
+        }
+    });
+}
+
+// A run of pixels [begin, end) within one row that lies inside the narrow band.
+struct Span {
+    uint32_t begin, end;
+};
+
+// Finds the pixels within radius pixels of the interface along both axes, as runs within each row.
+// The spans of row r are spans[row_start[r]] through spans[row_start[r + 1] - 1], ordered by column.
+// The band is a box dilation of the interface, which contains every pixel whose Euclidean distance
+// is at most radius along with the straight paths that reach it.
+void find_band(float const* dist, uint32_t width, uint32_t height, uint32_t radius,
+        vector<Span>* spans, vector<uint32_t>* row_start) {
+    // Mark pixels within radius of the interface along their row.
+    vector<uint8_t> near(uint64_t(width) * height);
+    parallel_for(height, 16, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t row = begin; row < end; ++row) {
+            float const* src = dist + uint64_t(row) * width;
+            uint8_t* dst = near.data() + uint64_t(row) * width;
+            int64_t last = -int64_t(radius) - 1;
+            for (uint32_t col = 0; col < width; ++col) {
+                if (src[col] < Infinity) last = col;
+                dst[col] = col - last <= radius;
+            }
+            last = int64_t(width) + radius;
+            for (uint32_t col = width; col-- > 0;) {
+                if (src[col] < Infinity) last = col;
+                dst[col] |= last - col <= radius;
+            }
+        }
+    });
+
+    // Dilate the marks along columns, one row at a time, then gather each row's spans.
+    vector<int64_t> above(width, -int64_t(radius) - 1);
+    vector<int64_t> below(width, int64_t(height) + radius);
+    vector<uint32_t> next_row(uint64_t(width) * height);
+    for (uint32_t row = height; row-- > 0;) {
+        for (uint32_t col = 0; col < width; ++col) {
+            if (near[uint64_t(row) * width + col]) below[col] = row;
+            next_row[uint64_t(row) * width + col] = std::min<int64_t>(below[col], UINT32_MAX);
+        }
+    }
+    spans->clear();
+    row_start->assign(height + 1, 0);
+    for (uint32_t row = 0; row < height; ++row) {
+        (*row_start)[row] = spans->size();
+        bool inside = false;
+        for (uint32_t col = 0; col < width; ++col) {
+            const uint64_t i = uint64_t(row) * width + col;
+            if (near[i]) above[col] = row;
+            const bool in_band = row - above[col] <= radius || next_row[i] - row <= radius;
+            if (in_band && !inside) spans->push_back({col, width});
+            if (!in_band && inside) spans->back().end = col;
+            inside = in_band;
+        }
+    }
+    (*row_start)[height] = spans->size();
+}
+
+// Gauss-Seidel sweep of the Godunov upwind discretization of |grad u| = 1, visiting the pixels of
+// the band in one of the four diagonal orderings. Frozen pixels keep their interface distances, and
+// pixels outside the band stay at Infinity.
+void sweep(float* u, vector<uint8_t> const& frozen, uint32_t width, uint32_t height,
+        vector<Span> const& spans, vector<uint32_t> const& row_start, int direction) {
+    const bool flipx = direction & 1;
+    const bool flipy = direction & 2;
+    for (uint32_t r = 0; r < height; ++r) {
+        const uint32_t row = flipy ? height - 1 - r : r;
+        const uint32_t first = row_start[row];
+        const uint32_t nspans = row_start[row + 1] - first;
+        for (uint32_t s = 0; s < nspans; ++s) {
+            const Span span = spans[first + (flipx ? nspans - 1 - s : s)];
+            for (uint32_t c = span.begin; c < span.end; ++c) {
+                const uint32_t col = flipx ? span.end - 1 - (c - span.begin) : c;
+                const uint32_t i = row * width + col;
+                if (frozen[i]) continue;
+                const float a = std::min(col > 0 ? u[i - 1] : Infinity,
+                        col + 1 < width ? u[i + 1] : Infinity);
+                const float b = std::min(row > 0 ? u[i - width] : Infinity,
+                        row + 1 < height ? u[i + width] : Infinity);
+                if (a == Infinity && b == Infinity) continue;
+                float candidate;
+                if (std::abs(a - b) >= 1) {
+                    candidate = std::min(a, b) + 1;
+                } else {
+                    candidate = 0.5f * (a + b + std::sqrt(2 - (a - b) * (a - b)));
+                }
+                u[i] = std::min(u[i], candidate);
+            }
+        }
+    }
+}
+
+// Solves for the distance to the zero crossing of the input with the fast sweeping method. The
+// four sweep orderings of each iteration run concurrently on separate copies, which are then
+// merged with a minimum (Zhao's parallel variant), and iterations stop once nothing changes.
+// The sign of the input is kept, so the zero crossing does not move.
+//
+// The output is in the units of generate_dshapes, where the shorter image dimension spans 1.0. If
+// band is non-zero, only pixels within the band are swept, and distances are clamped to
+// [-band, +band], so pixels far from the interface are set to the band's edge.
+bool Redistance::exec(vector<string> vargs) {
+    Options options = extract_options(vargs);
+    if (!check_options(options, {"band", "iterations"})) {
+        return false;
+    }
+    if (vargs.size() != 2) {
+        fmt::print("This command takes 2 arguments.\n");
+        return false;
+    }
+    const string input_file = vargs[0];
+    const string output_file = vargs[1];
+    const float band = options.count("band") ? atof(options["band"].c_str()) : 0;
+    const int max_iterations = options.count("iterations") ?
+            atoi(options["iterations"].c_str()) : 8;
+    if (max_iterations < 1) {
+        fmt::print("Iteration count must be at least 1.\n");
+        return false;
+    }
+
+    cnpy::NpyArray arr = cnpy::npy_load(input_file);
+    if (arr.shape.size() != 2) {
+        fmt::print("Input data has wrong shape.\n");
+        return false;
+    }
+    if (arr.word_size != sizeof(float) || arr.type_code != 'f') {
+        fmt::print("Input data has wrong data type.\n");
+        return false;
+    }
+    const uint32_t height = arr.shape[0];
+    const uint32_t width = arr.shape[1];
+    const uint32_t npixels = width * height;
+    float const* phi = arr.data<float>();
+
+    vector<float> dist(npixels);
+    find_interface(phi, width, height, dist.data());
+    vector<uint8_t> frozen(npixels);
+    uint32_t nfrozen = 0;
+    for (uint32_t i = 0; i < npixels; ++i) {
+        frozen[i] = dist[i] < Infinity;
+        nfrozen += frozen[i];
+    }
+    if (nfrozen == 0) {
+        fmt::print("Input has no zero crossing.\n");
+        return false;
+    }
+
+    // Without a band, every pixel is swept. With one, only pixels near the interface are swept
+    // and checked for convergence, and the rest stay at Infinity, which clamps to the band.
+    const uint32_t radius = band > 0 ?
+            uint32_t(std::ceil(band * std::min(width, height))) + 1 : std::max(width, height);
+    vector<Span> spans;
+    vector<uint32_t> row_start;
+    find_band(dist.data(), width, height, radius, &spans, &row_start);
+
+    vector<float> copies[4] = {dist, dist, dist, dist};
+    int iteration = 0;
+    float change = Infinity;
+    while (iteration < max_iterations && change > 1e-4f) {
+        parallel_for(4, 1, [&](uint32_t begin, uint32_t end) {
+            for (uint32_t direction = begin; direction < end; ++direction) {
+                float* copy = copies[direction].data();
+                for (uint32_t row = 0; row < height; ++row) {
+                    for (uint32_t s = row_start[row]; s < row_start[row + 1]; ++s) {
+                        const uint32_t first = row * width + spans[s].begin;
+                        const uint32_t last = row * width + spans[s].end;
+                        std::copy(dist.begin() + first, dist.begin() + last, copy + first);
+                    }
+                }
+                sweep(copy, frozen, width, height, spans, row_start, direction);
+            }
+        });
+        change = 0;
+        for (uint32_t row = 0; row < height; ++row) {
+            for (uint32_t s = row_start[row]; s < row_start[row + 1]; ++s) {
+                for (uint32_t i = row * width + spans[s].begin; i < row * width + spans[s].end;
+                        ++i) {
+                    const float u = std::min(std::min(copies[0][i], copies[1][i]),
+                            std::min(copies[2][i], copies[3][i]));
+                    if (dist[i] < Infinity) {
+                        change = std::max(change, dist[i] - u);
+                    } else if (u < Infinity) {
+                        change = Infinity;
+                    }
+                    dist[i] = u;
+                }
+            }
+        }
+        ++iteration;
+    }
+    if (change > 1e-4f) {
+        fmt::print("Stopped at the limit of {} iterations without converging.\n", iteration);
+    } else {
+        fmt::print("Converged after {} iterations.\n", iteration);
+    }
+
+    const float scale = 1.0f / std::min(width, height);
+    vector<float> result(npixels);
+    for (uint32_t i = 0; i < npixels; ++i) {
+        float d = dist[i] * scale;
+        if (band > 0) {
+            d = std::min(d, band);
+        }
+        result[i] = phi[i] > 0 ? d : -d;
+    }
+
+    const auto range = std::minmax_element(result.begin(), result.end());
+    fmt::print("SDF range is {} to {}\n", *range.first, *range.second);
+    cnpy::npy_save(output_file, result.data(), {height, width}, "w");
+    return true;
+}
+
+} // anonymous namespace
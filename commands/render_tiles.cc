@@ -0,0 +1,219 @@
+#include "clumpy_command.hh"
+#include "fmt/core.h"
+#include "cnpy/cnpy.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+using std::vector;
+using std::string;
+
+namespace {
+
+struct RenderTiles : ClumpyCommand {
+    RenderTiles() {}
+    bool exec(vector<string> args) override;
+    string description() const override {
+        return "render a generator command in tiles across worker processes";
+    }
+    string usage() const override {
+        return "<nworkers> <tile_dims> <command> <dims> ... <output_img>";
+    }
+    string example() const override {
+        return "4 512x512 generate_simplex 2048x2048 1.0 16.0 26 out.npy";
+    }
+};
+
+static ClumpyCommand::Register registrar("render_tiles", [] {
+    return new RenderTiles();
+});
+
+struct Tile {
+    uint32_t left, top, width, height;
+    string filename;
+};
+
+// Runs the command in a forked child process, which exits with the command's status.
+pid_t spawn(string const& command, vector<string> args) {
+    fflush(stdout);
+    const pid_t pid = fork();
+    if (pid == 0) {
+        auto cmd = ClumpyCommand::registry()[command]();
+        const bool success = cmd->exec(args);
+        fflush(stdout);
+        _exit(success ? 0 : 1);
+    }
+    return pid;
+}
+
+// Copies a tile into the full image. Tiles follow the generator's layout, which is an optional
+// leading frame axis, then height and width, then a channel axis if the generator was asked for
+// more than one channel. The axes are not inferred from their sizes, since a frame or channel count
+// can equal a tile dimension.
+bool assemble(Tile const& tile, uint32_t width, uint32_t height, bool has_channels,
+        vector<size_t>* shape, vector<float>* image) {
+    cnpy::NpyArray arr = cnpy::npy_load(tile.filename);
+    if (arr.word_size != sizeof(float) || arr.type_code != 'f') {
+        fmt::print("Tiles must be float32.\n");
+        return false;
+    }
+    const size_t rank = arr.shape.size();
+    const size_t min_rank = has_channels ? 3 : 2;
+    if (rank < min_rank) {
+        fmt::print("Tile has an unexpected shape.\n");
+        return false;
+    }
+    const size_t axis = rank - min_rank;
+    if (axis > 1 || arr.shape[axis] != tile.height || arr.shape[axis + 1] != tile.width) {
+        fmt::print("Tile has an unexpected shape.\n");
+        return false;
+    }
+    size_t nstack = 1, nchannels = 1;
+    for (size_t i = 0; i < axis; ++i) nstack *= arr.shape[i];
+    for (size_t i = axis + 2; i < arr.shape.size(); ++i) nchannels *= arr.shape[i];
+
+    if (image->empty()) {
+        *shape = arr.shape;
+        (*shape)[axis] = height;
+        (*shape)[axis + 1] = width;
+        image->resize(nstack * height * width * nchannels);
+    }
+
+    float const* src = arr.data<float>();
+    const size_t tile_row_size = tile.width * nchannels;
+    const size_t image_row_size = width * nchannels;
+    for (size_t layer = 0; layer < nstack; ++layer) {
+        float* dst = image->data() + layer * height * image_row_size;
+        for (uint32_t row = 0; row < tile.height; ++row, src += tile_row_size) {
+            std::copy(src, src + tile_row_size,
+                    dst + (tile.top + row) * image_row_size + tile.left * nchannels);
+        }
+    }
+    return true;
+}
+
+// Splits the image described by the generator's dims argument into tiles, renders each tile in a
+// worker process with the generator's tile option, and assembles the results. At most nworkers
+// processes run at once. The generator must take dims as its first argument and the output file
+// as its last, which is true of generate_simplex, generate_dshapes and polygon_sdf.
+bool RenderTiles::exec(vector<string> vargs) {
+    if (vargs.size() < 5) {
+        fmt::print("This command takes at least 5 arguments.\n");
+        return false;
+    }
+    const uint32_t nworkers = std::max(1, atoi(vargs[0].c_str()));
+    const string tile_dims = vargs[1];
+    const string command = vargs[2];
+    vector<string> args(vargs.begin() + 3, vargs.end());
+    const uint32_t tile_width = atoi(tile_dims.c_str());
+    const uint32_t tile_height = atoi(tile_dims.substr(tile_dims.find('x') + 1).c_str());
+
+    if (command != "generate_simplex" && command != "generate_dshapes" &&
+            command != "polygon_sdf") {
+        fmt::print("Command must be generate_simplex, generate_dshapes or polygon_sdf.\n");
+        return false;
+    }
+    for (auto const& arg : args) {
+        if (arg.find("tile=") == 0) {
+            fmt::print("The tile option is supplied by render_tiles.\n");
+            return false;
+        }
+    }
+
+    // Only generate_simplex emits channels, and only in its derivatives and curl modes.
+    vector<string> generator_args = args;
+    Options generator_options = extract_options(generator_args);
+    const bool has_channels = command == "generate_simplex" &&
+            generator_options.count("mode") && generator_options["mode"] != "value";
+
+    const string dims = args.front();
+    const uint32_t width = atoi(dims.c_str());
+    const uint32_t height = atoi(dims.substr(dims.find('x') + 1).c_str());
+    if (width == 0 || height == 0 || tile_width == 0 || tile_height == 0) {
+        fmt::print("Image and tile dimensions must be non-zero.\n");
+        return false;
+    }
+
+    // The output is the last positional argument.
+    size_t output_index = args.size() - 1;
+    while (output_index > 0 && args[output_index].find('=') != string::npos) {
+        --output_index;
+    }
+    const string output_file = args[output_index];
+
+    char tempdir[] = "/tmp/clumpy_tiles_XXXXXX";
+    if (!mkdtemp(tempdir)) {
+        fmt::print("Unable to create temporary directory.\n");
+        return false;
+    }
+
+    vector<Tile> tiles;
+    for (uint32_t top = 0; top < height; top += tile_height) {
+        for (uint32_t left = 0; left < width; left += tile_width) {
+            Tile tile;
+            tile.left = left;
+            tile.top = top;
+            tile.width = std::min(tile_width, width - left);
+            tile.height = std::min(tile_height, height - top);
+            tile.filename = fmt::format("{}/tile{:06}.npy", tempdir, tiles.size());
+            tiles.push_back(tile);
+        }
+    }
+
+    // Keep up to nworkers children busy until every tile is done.
+    bool success = true;
+    std::map<pid_t, size_t> running;
+    size_t next_tile = 0;
+    while (next_tile < tiles.size() || !running.empty()) {
+        while (success && next_tile < tiles.size() && running.size() < nworkers) {
+            Tile const& tile = tiles[next_tile];
+            vector<string> tile_args = args;
+            tile_args[output_index] = tile.filename;
+            tile_args.push_back(fmt::format("tile={},{},{},{}", tile.left, tile.top, tile.width,
+                    tile.height));
+            const pid_t pid = spawn(command, tile_args);
+            if (pid < 0) {
+                fmt::print("Unable to fork a worker.\n");
+                success = false;
+                break;
+            }
+            running[pid] = next_tile++;
+        }
+        if (running.empty()) {
+            break;
+        }
+        int status;
+        const pid_t pid = wait(&status);
+        if (pid < 0) {
+            break;
+        }
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fmt::print("Tile {} failed.\n", running[pid]);
+            success = false;
+        }
+        running.erase(pid);
+    }
+
+    vector<size_t> shape;
+    vector<float> image;
+    for (auto const& tile : tiles) {
+        if (success) {
+            success = assemble(tile, width, height, has_channels, &shape, &image);
+        }
+        remove(tile.filename.c_str());
+    }
+    rmdir(tempdir);
+    if (!success) {
+        return false;
+    }
+
+    fmt::print("Assembled {} tiles into {}\n", tiles.size(), output_file);
+    cnpy::npy_save(output_file, image.data(), shape, "w");
+    return true;
+}
+
+} // anonymous namespace
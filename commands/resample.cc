@@ -0,0 +1,276 @@
+#include "clumpy_command.hh"
+#include "clumpy_parallel.hh"
+#include "fmt/core.h"
+#include "cnpy/cnpy.h"
+
+#include <glm/vec2.hpp>
+#include <glm/vec4.hpp>
+#include <glm/ext.hpp>
+
+#include <cmath>
+#include <type_traits>
+
+using namespace glm;
+
+using std::vector;
+using std::string;
+
+bool resample_image(float const* src, u32vec2 srcdims, uint32_t nchannels, vec4 viewport,
+        string const& filter, float* dst, u32vec2 dstdims);
+
+namespace {
+
+struct Resample : ClumpyCommand {
+    Resample() {}
+    bool exec(vector<string> args) override;
+    string description() const override {
+        return "resample a region of an image using a separable filter";
+    }
+    string usage() const override {
+        return "<input_img> <viewport> <dims> <filter> <output_img>";
+    }
+    string example() const override {
+        return "in.npy '0.25,0.25,0.75,0.75' 512x512 lanczos out.npy";
+    }
+};
+
+static ClumpyCommand::Register registrar("resample", [] {
+    return new Resample();
+});
+
+// Parses strings like "0.0,0.0,1.0,1.0"
+vec4 parse_viewport(string tuple) {
+    vec4 result;
+    for (int i = 0; i < 4; ++i) {
+        result[i] = atof(tuple.c_str());
+        tuple = tuple.substr(tuple.find(',') + 1);
+    }
+    return result;
+}
+
+float sinc(float x) {
+    if (x == 0) return 1.0f;
+    x *= pi<float>();
+    return sinf(x) / x;
+}
+
+struct Filter {
+    float radius;
+    float (*weight)(float);
+};
+
+bool find_filter(string const& name, Filter* filter) {
+    if (name == "bilinear") {
+        *filter = {1.0f, [](float x) { return std::max(0.0f, 1.0f - std::abs(x)); }};
+        return true;
+    }
+    if (name == "bicubic") {
+        // Catmull-Rom spline.
+        *filter = {2.0f, [](float x) {
+            x = std::abs(x);
+            if (x < 1) return 1.5f * x * x * x - 2.5f * x * x + 1.0f;
+            if (x < 2) return -0.5f * x * x * x + 2.5f * x * x - 4.0f * x + 2.0f;
+            return 0.0f;
+        }};
+        return true;
+    }
+    if (name == "lanczos") {
+        *filter = {3.0f, [](float x) { return std::abs(x) < 3 ? sinc(x) * sinc(x / 3) : 0.0f; }};
+        return true;
+    }
+    return false;
+}
+
+// Precomputed filter taps for one axis. Every output sample has the same number of taps, which
+// keeps the inner loops free of branches. Unused taps have zero weight.
+struct Taps {
+    uint32_t ntaps;
+    vector<uint32_t> first;
+    vector<float> weights;
+};
+
+// Maps output samples onto [left, right] of the source, which spans [0, 1]. The first and last
+// samples land exactly on left and right, matching the linspace convention in extras/island.py.
+// When minifying, the filter is widened to avoid aliasing. Indices are clamped to the edge.
+Taps compute_taps(Filter filter, uint32_t srcsize, uint32_t dstsize, float left, float right) {
+    const float srcmax = srcsize - 1;
+    const float step = dstsize > 1 ? (right - left) * srcmax / (dstsize - 1) : 0;
+    const float scale = std::max(1.0f, std::abs(step));
+    const float support = filter.radius * scale;
+    Taps taps;
+    taps.ntaps = std::min(srcsize, uint32_t(2 * std::ceil(support) + 1));
+    taps.first.resize(dstsize);
+    taps.weights.resize(dstsize * taps.ntaps);
+    vector<float> accum(srcsize);
+    for (uint32_t i = 0; i < dstsize; ++i) {
+        const float center = left * srcmax + step * i;
+        const int32_t lo = (int32_t) std::floor(center - support);
+        const int32_t hi = (int32_t) std::ceil(center + support);
+
+        // Gather the weights by clamped source index, so that samples past the edges fold onto
+        // the edge pixels.
+        int32_t minindex = srcsize, maxindex = -1;
+        float total = 0;
+        for (int32_t j = lo; j <= hi; ++j) {
+            const float w = filter.weight((j - center) / scale);
+            if (w == 0) continue;
+            const int32_t index = clamp(j, 0, int32_t(srcsize) - 1);
+            if (minindex > maxindex) {
+                minindex = maxindex = index;
+                accum[index] = 0;
+            }
+            while (index < minindex) accum[--minindex] = 0;
+            while (index > maxindex) accum[++maxindex] = 0;
+            accum[index] += w;
+            total += w;
+        }
+        if (minindex > maxindex) {
+            minindex = maxindex = clamp(int32_t(std::lround(center)), 0, int32_t(srcsize) - 1);
+            accum[minindex] = total = 1;
+        }
+
+        // Shift the window left if it would read past the end of the source.
+        uint32_t first = std::min(uint32_t(minindex), srcsize - taps.ntaps);
+        taps.first[i] = first;
+        float* weights = &taps.weights[i * taps.ntaps];
+        for (int32_t j = minindex; j <= maxindex; ++j) {
+            weights[j - first] = accum[j] / total;
+        }
+    }
+    return taps;
+}
+
+// Separable resampling. The horizontal pass only processes the source rows that the vertical pass
+// reads, and both passes are parallel over rows. The vertical pass is a weighted sum of contiguous
+// rows, which the compiler vectorizes. The channel count is a template parameter so that each
+// texel is accumulated with fixed-width arithmetic.
+template<typename T, uint32_t nchannels>
+void resample(T const* src, u32vec2 srcdims, vec4 viewport, Filter filter, T* dst,
+        u32vec2 dstdims) {
+    const Taps xtaps = compute_taps(filter, srcdims.x, dstdims.x, viewport.x, viewport.z);
+    const Taps ytaps = compute_taps(filter, srcdims.y, dstdims.y, viewport.y, viewport.w);
+
+    uint32_t row0 = srcdims.y, row1 = 0;
+    for (uint32_t first : ytaps.first) {
+        row0 = std::min(row0, first);
+        row1 = std::max(row1, first + ytaps.ntaps);
+    }
+
+    const uint32_t rowsize = dstdims.x * nchannels;
+    vector<float> temp((row1 - row0) * rowsize);
+    parallel_for(row1 - row0, 16, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t row = begin; row < end; ++row) {
+            T const* srcrow = src + (row0 + row) * srcdims.x * nchannels;
+            float* dstrow = temp.data() + row * rowsize;
+            float const* weights = xtaps.weights.data();
+            for (uint32_t col = 0; col < dstdims.x; ++col, weights += xtaps.ntaps) {
+                T const* texel = srcrow + xtaps.first[col] * nchannels;
+                float sum[nchannels] = {};
+                for (uint32_t tap = 0; tap < xtaps.ntaps; ++tap, texel += nchannels) {
+                    for (uint32_t c = 0; c < nchannels; ++c) {
+                        sum[c] += weights[tap] * texel[c];
+                    }
+                }
+                for (uint32_t c = 0; c < nchannels; ++c) {
+                    *dstrow++ = sum[c];
+                }
+            }
+        }
+    });
+
+    parallel_for(dstdims.y, 16, [&](uint32_t begin, uint32_t end) {
+        vector<float> sum(rowsize);
+        for (uint32_t row = begin; row < end; ++row) {
+            std::fill(sum.begin(), sum.end(), 0.0f);
+            float const* weights = &ytaps.weights[row * ytaps.ntaps];
+            float const* srcrow = temp.data() + (ytaps.first[row] - row0) * rowsize;
+            for (uint32_t tap = 0; tap < ytaps.ntaps; ++tap, srcrow += rowsize) {
+                const float w = weights[tap];
+                for (uint32_t i = 0; i < rowsize; ++i) {
+                    sum[i] += w * srcrow[i];
+                }
+            }
+            T* dstrow = dst + row * rowsize;
+            for (uint32_t i = 0; i < rowsize; ++i) {
+                dstrow[i] = std::is_integral<T>::value ?
+                        T(clamp(sum[i] + 0.5f, 0.0f, 255.0f)) : T(sum[i]);
+            }
+        }
+    });
+}
+
+template<typename T>
+void resample(T const* src, u32vec2 srcdims, uint32_t nchannels, vec4 viewport, Filter filter,
+        T* dst, u32vec2 dstdims) {
+    switch (nchannels) {
+        case 1: resample<T, 1>(src, srcdims, viewport, filter, dst, dstdims); break;
+        case 2: resample<T, 2>(src, srcdims, viewport, filter, dst, dstdims); break;
+        case 3: resample<T, 3>(src, srcdims, viewport, filter, dst, dstdims); break;
+        case 4: resample<T, 4>(src, srcdims, viewport, filter, dst, dstdims); break;
+    }
+}
+
+bool Resample::exec(vector<string> vargs) {
+    if (vargs.size() != 5) {
+        fmt::print("This command takes 5 arguments.\n");
+        return false;
+    }
+    const string input_file = vargs[0];
+    const vec4 viewport = parse_viewport(vargs[1]);
+    const string dims = vargs[2];
+    const string filter_name = vargs[3];
+    const string output_file = vargs[4];
+    const uint32_t width = atoi(dims.c_str());
+    const uint32_t height = atoi(dims.substr(dims.find('x') + 1).c_str());
+
+    Filter filter;
+    if (!find_filter(filter_name, &filter)) {
+        fmt::print("Filter must be bilinear/bicubic/lanczos.\n");
+        return false;
+    }
+
+    cnpy::NpyArray arr = cnpy::npy_load(input_file);
+    if (arr.shape.size() != 2 && arr.shape.size() != 3) {
+        fmt::print("Input data has wrong shape.\n");
+        return false;
+    }
+    const uint32_t nchannels = arr.shape.size() == 3 ? arr.shape[2] : 1;
+    if (nchannels < 1 || nchannels > 4) {
+        fmt::print("Input image must have 1 to 4 channels.\n");
+        return false;
+    }
+    const u32vec2 srcdims(arr.shape[1], arr.shape[0]);
+    const u32vec2 dstdims(width, height);
+    vector<size_t> shape {height, width};
+    if (arr.shape.size() == 3) {
+        shape.push_back(nchannels);
+    }
+
+    if (arr.word_size == sizeof(float) && arr.type_code == 'f') {
+        vector<float> result(width * height * nchannels);
+        resample(arr.data<float>(), srcdims, nchannels, viewport, filter, result.data(), dstdims);
+        cnpy::npy_save(output_file, result.data(), shape, "w");
+    } else if (arr.word_size == sizeof(uint8_t) && arr.type_code == 'u') {
+        vector<uint8_t> result(width * height * nchannels);
+        resample(arr.data<uint8_t>(), srcdims, nchannels, viewport, filter, result.data(),
+                dstdims);
+        cnpy::npy_save(output_file, result.data(), shape, "w");
+    } else {
+        fmt::print("Input data must be float32 or uint8.\n");
+        return false;
+    }
+    return true;
+}
+
+} // anonymous namespace
+
+// Resamples the viewport region (left, top, right, bottom in [0,1]) of a float image.
+bool resample_image(float const* src, u32vec2 srcdims, uint32_t nchannels, vec4 viewport,
+        string const& filter_name, float* dst, u32vec2 dstdims) {
+    Filter filter;
+    if (!find_filter(filter_name, &filter)) {
+        return false;
+    }
+    resample(src, srcdims, nchannels, viewport, filter, dst, dstdims);
+    return true;
+}
@@ -0,0 +1,242 @@
+#include "clumpy_command.hh"
+#include "clumpy_parallel.hh"
+#include "fmt/core.h"
+#include "cnpy/cnpy.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using std::vector;
+using std::string;
+
+struct GradientNoiseTable;
+GradientNoiseTable* create_gradient_noise_table(int seed);
+void free_gradient_noise_table(GradientNoiseTable* table);
+void gradient_noise_points(GradientNoiseTable const* table, float const* xs, float const* ys,
+        uint32_t count, int seed, float* values);
+
+struct osn_context;
+
+int open_simplex_noise(int64_t seed, struct osn_context** ctx);
+int open_simplex_noise_stateless(int64_t seed, struct osn_context** ctx);
+void open_simplex_noise_free(struct osn_context* ctx);
+double open_simplex_noise2(struct osn_context* ctx, double x, double y);
+double open_simplex_noise3(struct osn_context* ctx, double x, double y, double z);
+
+namespace {
+
+struct SampleNoise : ClumpyCommand {
+    SampleNoise() {}
+    bool exec(vector<string> args) override;
+    string description() const override {
+        return "evaluate noise at each point in a list of 2D or 3D points";
+    }
+    string usage() const override {
+        return "<input_pts> <noise> <frequency> <seed> <output_npy> [octaves=1] [lacunarity=2] "
+                "[gain=0.5] [hash=table]";
+    }
+    string example() const override {
+        return "pts.npy simplex 4.0 0 values.npy octaves=4";
+    }
+};
+
+static ClumpyCommand::Register registrar("sample_noise", [] {
+    return new SampleNoise();
+});
+
+// Points are evaluated in chunks of consecutive Morton order. Each chunk is gathered into
+// contiguous coordinate arrays for the SIMD kernel, and its results are scattered back.
+constexpr uint32_t ChunkSize = 4096;
+
+// Inserts one zero bit between each of the low 16 bits.
+uint32_t part1by1(uint32_t x) {
+    x &= 0x0000ffff;
+    x = (x | (x << 8)) & 0x00ff00ff;
+    x = (x | (x << 4)) & 0x0f0f0f0f;
+    x = (x | (x << 2)) & 0x33333333;
+    x = (x | (x << 1)) & 0x55555555;
+    return x;
+}
+
+// Inserts two zero bits between each of the low 10 bits.
+uint32_t part1by2(uint32_t x) {
+    x &= 0x000003ff;
+    x = (x | (x << 16)) & 0xff0000ff;
+    x = (x | (x << 8)) & 0x0300f00f;
+    x = (x | (x << 4)) & 0x030c30c3;
+    x = (x | (x << 2)) & 0x09249249;
+    return x;
+}
+
+// Returns point indices sorted along a Z-order curve through the bounding box, so that points
+// evaluated together touch the same lattice cells.
+vector<uint32_t> morton_order(float const* pts, uint32_t count, uint32_t ndims) {
+    float lo[3], hi[3];
+    std::fill(lo, lo + 3, std::numeric_limits<float>::max());
+    std::fill(hi, hi + 3, std::numeric_limits<float>::lowest());
+    for (uint32_t i = 0; i < count; ++i) {
+        for (uint32_t d = 0; d < ndims; ++d) {
+            lo[d] = std::min(lo[d], pts[i * ndims + d]);
+            hi[d] = std::max(hi[d], pts[i * ndims + d]);
+        }
+    }
+
+    const uint32_t nbits = ndims == 2 ? 16 : 10;
+    const float maxcell = (1 << nbits) - 1;
+    vector<uint64_t> keys(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t code = 0;
+        for (uint32_t d = 0; d < ndims; ++d) {
+            const float extent = hi[d] - lo[d];
+            const float t = extent > 0 ? (pts[i * ndims + d] - lo[d]) / extent : 0;
+            const uint32_t cell = uint32_t(t * maxcell);
+            code |= (ndims == 2 ? part1by1(cell) : part1by2(cell)) << d;
+        }
+        keys[i] = (uint64_t(code) << 32) | i;
+    }
+    std::sort(keys.begin(), keys.end());
+
+    vector<uint32_t> order(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        order[i] = uint32_t(keys[i]);
+    }
+    return order;
+}
+
+// Sums the octaves of noise at each point. The first octave has unit amplitude at the given
+// frequency, and each successive octave multiplies the frequency by the lacunarity and the
+// amplitude by the gain. Octaves use consecutive seeds so that their lattices are decorrelated.
+//
+// Gradient noise is 2D only and runs on the SIMD kernel from gradient_noise. Simplex noise is
+// evaluated one point at a time, in 3D when the points have a time coordinate.
+bool SampleNoise::exec(vector<string> vargs) {
+    Options options = extract_options(vargs);
+    if (!check_options(options, {"octaves", "lacunarity", "gain", "hash"})) {
+        return false;
+    }
+    if (vargs.size() != 5) {
+        fmt::print("This command takes 5 arguments.\n");
+        return false;
+    }
+    const string input_pts = vargs[0];
+    const string noise = vargs[1];
+    const float frequency = atof(vargs[2].c_str());
+    const int seed = atoi(vargs[3].c_str());
+    const string output_file = vargs[4];
+    const int octaves = options.count("octaves") ? atoi(options["octaves"].c_str()) : 1;
+    const float lacunarity = options.count("lacunarity") ? atof(options["lacunarity"].c_str()) : 2;
+    const float gain = options.count("gain") ? atof(options["gain"].c_str()) : 0.5;
+    const string hash = options.count("hash") ? options["hash"] : "table";
+
+    if (noise != "simplex" && noise != "gradient") {
+        fmt::print("Noise must be simplex/gradient.\n");
+        return false;
+    }
+    if (octaves < 1) {
+        fmt::print("Octave count must be at least 1.\n");
+        return false;
+    }
+    if (hash != "table" && hash != "stateless") {
+        fmt::print("Hash must be table/stateless.\n");
+        return false;
+    }
+    const bool stateless = hash == "stateless";
+
+    cnpy::NpyArray arr = cnpy::npy_load(input_pts);
+    if (arr.shape.size() != 2 || (arr.shape[1] != 2 && arr.shape[1] != 3)) {
+        fmt::print("Input points have wrong shape.\n");
+        return false;
+    }
+    if (arr.word_size != sizeof(float) || arr.type_code != 'f') {
+        fmt::print("Input points have wrong data type.\n");
+        return false;
+    }
+    const uint32_t count = arr.shape[0];
+    const uint32_t ndims = arr.shape[1];
+    if (noise == "gradient" && ndims != 2) {
+        fmt::print("Gradient noise requires 2D points.\n");
+        return false;
+    }
+    float const* pts = arr.data<float>();
+
+    vector<float> frequencies(octaves), amplitudes(octaves);
+    for (int octave = 0; octave < octaves; ++octave) {
+        frequencies[octave] = frequency * std::pow(lacunarity, float(octave));
+        amplitudes[octave] = std::pow(gain, float(octave));
+    }
+
+    // Tables and contexts are built once per octave and shared by every chunk of points.
+    vector<GradientNoiseTable*> tables;
+    if (noise == "gradient" && !stateless) {
+        for (int octave = 0; octave < octaves; ++octave) {
+            tables.push_back(create_gradient_noise_table(seed + octave));
+        }
+    }
+    vector<struct osn_context*> contexts;
+    if (noise == "simplex") {
+        contexts.resize(octaves);
+        for (int octave = 0; octave < octaves; ++octave) {
+            if (stateless) {
+                open_simplex_noise_stateless(seed + octave, &contexts[octave]);
+            } else {
+                open_simplex_noise(seed + octave, &contexts[octave]);
+            }
+        }
+    }
+
+    const vector<uint32_t> order = morton_order(pts, count, ndims);
+    vector<float> result(count);
+    parallel_for(count, ChunkSize, [&](uint32_t begin, uint32_t end) {
+        const uint32_t n = end - begin;
+        vector<float> sum(n, 0.0f);
+        if (noise == "gradient") {
+            vector<float> xs(n), ys(n), values(n);
+            for (int octave = 0; octave < octaves; ++octave) {
+                const float f = frequencies[octave];
+                for (uint32_t i = 0; i < n; ++i) {
+                    float const* pt = pts + order[begin + i] * 2;
+                    xs[i] = pt[0] * f;
+                    ys[i] = pt[1] * f;
+                }
+                gradient_noise_points(stateless ? nullptr : tables[octave], xs.data(), ys.data(),
+                        n, seed + octave, values.data());
+                const float amplitude = amplitudes[octave];
+                for (uint32_t i = 0; i < n; ++i) {
+                    sum[i] += amplitude * values[i];
+                }
+            }
+        } else {
+            for (uint32_t i = 0; i < n; ++i) {
+                float const* pt = pts + order[begin + i] * ndims;
+                for (int octave = 0; octave < octaves; ++octave) {
+                    const double f = frequencies[octave];
+                    struct osn_context* ctx = contexts[octave];
+                    const double value = ndims == 2 ?
+                            open_simplex_noise2(ctx, pt[0] * f, pt[1] * f) :
+                            open_simplex_noise3(ctx, pt[0] * f, pt[1] * f, pt[2] * f);
+                    sum[i] += amplitudes[octave] * value;
+                }
+            }
+        }
+        for (uint32_t i = 0; i < n; ++i) {
+            result[order[begin + i]] = sum[i];
+        }
+    });
+
+    for (auto table : tables) {
+        free_gradient_noise_table(table);
+    }
+    for (auto ctx : contexts) {
+        open_simplex_noise_free(ctx);
+    }
+
+    if (count > 0) {
+        const auto range = std::minmax_element(result.begin(), result.end());
+        fmt::print("Noise range is {} to {}\n", *range.first, *range.second);
+    }
+    cnpy::npy_save(output_file, result.data(), {count}, "w");
+    return true;
+}
+
+} // anonymous namespace
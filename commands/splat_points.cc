@@ -5,8 +5,13 @@
 #include <glm/vec2.hpp>
 #include <glm/ext.hpp>
 
+#include <cstring>
 #include <limits>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 using namespace glm;
 
 using std::vector;
@@ -16,6 +21,8 @@ using std::numeric_limits;
 void splat_points(vec2 const* ptlist, uint32_t npts, u32vec2 dims, uint8_t* dstimg);
 void splat_disks(vec2 const* ptlist, uint32_t npts, u32vec2 dims, uint8_t* dstimg, float alpha,
         int kernel_size);
+void splat_disks_supersampled(vec2 const* ptlist, uint32_t npts, u32vec2 dims, uint8_t* dstimg,
+        float alpha, int kernel_size, int factor);
 
 bool advect_wrapx = false;
 
@@ -30,10 +37,11 @@ struct SplatPoints : ClumpyCommand {
         return "consume a list of 2-tuples and create an image";
     }
     string usage() const override {
-        return "<input_pts> <dims> <kernel_type> <kernel_size> <alpha> <output_img>";
+        return "<input_pts> <dims> <kernel_type> <kernel_size> <alpha> <output_img> "
+                "[supersample=1]";
     }
     string example() const override {
-        return "bridson.npy 500x250 u8disk 5 1.0 splat.npy";
+        return "bridson.npy 500x250 u8disk 5 1.0 splat.npy supersample=4";
     }
 };
 
@@ -42,6 +50,10 @@ static ClumpyCommand::Register registrar("splat_points", [] {
 });
 
 bool SplatPoints::exec(vector<string> vargs) {
+    const Options options = extract_options(vargs);
+    if (!check_options(options, {"supersample"})) {
+        return false;
+    }
     if (vargs.size() != 6) {
         fmt::print("The command takes 6 arguments.\n");
         return false;
@@ -54,6 +66,13 @@ bool SplatPoints::exec(vector<string> vargs) {
     const string output_file = vargs[5];
     const uint32_t width = atoi(dims.c_str());
     const uint32_t height = atoi(dims.substr(dims.find('x') + 1).c_str());
+    const int supersample = options.count("supersample") ?
+            atoi(options.at("supersample").c_str()) : 1;
+
+    if (supersample < 1 || supersample > 16) {
+        fmt::print("Supersample factor must be an integer in [1,16].\n");
+        return false;
+    }
 
     if (0 == (kernel_size % 2)) {
         fmt::print("Kernel size must be an odd integer.\n");
@@ -90,7 +109,10 @@ bool SplatPoints::exec(vector<string> vargs) {
     dstimg.resize(width * height);
     fmt::print("Drawing {} points.\n", npts);
     const u32vec2 size(width, height);
-    if (alpha == 1 && kernel_size == 1) {
+    if (kernel_type == u8disk && supersample > 1) {
+        splat_disks_supersampled(ptlist, npts, size, dstimg.data(), alpha, kernel_size,
+                supersample);
+    } else if (alpha == 1 && kernel_size == 1) {
         splat_points(ptlist, npts, size, dstimg.data());
     } else if (kernel_type == u8disk) {
         splat_disks(ptlist, npts, size, dstimg.data(), alpha, kernel_size);
@@ -115,10 +137,10 @@ void splat_points(vec2 const* ptlist, uint32_t npts, u32vec2 size, uint8_t* dsti
     }
 }
 
-void splat_disks(vec2 const* ptlist, uint32_t npts, u32vec2 dims, uint8_t* dstimg, float alpha,
-        int kernel_size) {
+namespace {
 
-    // First, create an AA mask for the sprite.
+// Creates an AA mask for the sprite.
+vector<float> create_sprite(float alpha, int kernel_size) {
     if (0 == (kernel_size % 2)) {
         fmt::print("Kernel size must be an odd integer.\n");
         exit(1);
@@ -134,6 +156,119 @@ void splat_disks(vec2 const* ptlist, uint32_t npts, u32vec2 dims, uint8_t* dstim
             sprite[i + j * kernel_size] = alpha * smoothstep(r2 + 5.0f, r2 - 5.0f, d2);
         }
     }
+    return sprite;
+}
+
+// Blends a row of sprite pixels using src-over. Fixed-size rows are processed four pixels at a
+// time with SSE2, which keeps the whole row in registers.
+template<int RowWidth>
+inline void blend_row(uint8_t* dst, float const* src, float const* keep, int32_t row_width) {
+    int32_t col = 0;
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    for (; col + 4 <= RowWidth; col += 4) {
+        int32_t packed;
+        memcpy(&packed, dst + col, 4);
+        __m128i pixels = _mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero);
+        pixels = _mm_unpacklo_epi16(pixels, zero);
+        __m128 blended = _mm_mul_ps(_mm_loadu_ps(keep + col), _mm_cvtepi32_ps(pixels));
+        blended = _mm_add_ps(blended, _mm_loadu_ps(src + col));
+        pixels = _mm_cvttps_epi32(blended);
+        pixels = _mm_packus_epi16(_mm_packs_epi32(pixels, zero), zero);
+        packed = _mm_cvtsi128_si32(pixels);
+        memcpy(dst + col, &packed, 4);
+    }
+#endif
+    const int32_t width = RowWidth ? RowWidth : row_width;
+    for (; col < width; ++col) {
+        uint32_t val = dst[col];
+        dst[col] = (uint8_t) (keep[col] * val + src[col]);
+    }
+}
+
+// Blends in the points with src-over blending. When KernelSize is non-zero, the sprite extent is
+// known at compile time, which allows the compiler to unroll the sprite and vectorize its rows.
+// Sprites that are wholly inside the image skip the per-pixel bounds checks and wrap-around logic.
+template<int KernelSize>
+void blend_sprites(vec2 const* ptlist, uint32_t npts, u32vec2 dims, uint8_t* dstimg,
+        float const* sprite, int kernel_size) {
+    const int32_t size = KernelSize ? KernelSize : kernel_size;
+    const int32_t width = (int32_t) dims.x;
+    const int32_t height = (int32_t) dims.y;
+    const int32_t h = size / 2;
+
+    // Specialized rows are padded to a multiple of 4 pixels. The padding has keep=1 and src=0,
+    // which leaves the destination untouched.
+    constexpr int32_t kRowWidth = KernelSize > 1 ? (KernelSize + 3) & ~3 : KernelSize;
+    const int32_t row_width = kRowWidth ? kRowWidth : size;
+
+    // Hoist the per-pixel blend factors out of the loop.
+    vector<float> srcvals(row_width * size, 0.0f);
+    vector<float> keepvals(row_width * size, 1.0f);
+    for (int32_t row = 0; row < size; ++row) {
+        for (int32_t col = 0; col < size; ++col) {
+            const float alpha = sprite[col + row * size];
+            srcvals[col + row * row_width] = alpha * 255.0f;
+            keepvals[col + row * row_width] = 1.0f - alpha;
+        }
+    }
+
+    for (uint32_t i = 0; i < npts; ++i) {
+        int32_t x = (int32_t) ptlist[i].x;
+        int32_t y = (int32_t) ptlist[i].y;
+        float const* spriteval = sprite;
+
+        // Fast path: the entire sprite (including its padding) is inside the image.
+        if (x - h >= 0 && y - h >= 0 && x - h + row_width <= width && y + h < height) {
+            uint8_t* dstrow = dstimg + width * (y - h) + (x - h);
+            float const* src = srcvals.data();
+            float const* keep = keepvals.data();
+            for (int32_t row = 0; row < size; ++row) {
+                blend_row<kRowWidth>(dstrow, src, keep, row_width);
+                dstrow += width;
+                src += row_width;
+                keep += row_width;
+            }
+            continue;
+        }
+
+        for (int32_t y0 = y - h; y0 <= y + h; ++y0) {
+        for (int32_t x0 = x - h; x0 <= x + h; ++x0) {
+            int32_t xx = x0;
+            if (advect_wrapx) {
+                xx = (width + (x0 % width)) % width;
+            }
+            if (xx >= 0 && y0 >= 0 && xx < width && y0 < height) {
+                float alpha = *spriteval;
+                uint32_t dst = dstimg[width * y0 + xx];
+                dstimg[width * y0 + xx] = (uint8_t) ((1.0f - alpha) * dst + alpha * 255.0f);
+            }
+            ++spriteval;
+        }
+        }
+    }
+}
+
+} // anonymous namespace
+
+void splat_disks(vec2 const* ptlist, uint32_t npts, u32vec2 dims, uint8_t* dstimg, float alpha,
+        int kernel_size) {
+    const vector<float> sprite = create_sprite(alpha, kernel_size);
+    float const* sp = sprite.data();
+    switch (kernel_size) {
+        case 1: blend_sprites<1>(ptlist, npts, dims, dstimg, sp, kernel_size); break;
+        case 3: blend_sprites<3>(ptlist, npts, dims, dstimg, sp, kernel_size); break;
+        case 5: blend_sprites<5>(ptlist, npts, dims, dstimg, sp, kernel_size); break;
+        case 7: blend_sprites<7>(ptlist, npts, dims, dstimg, sp, kernel_size); break;
+        case 9: blend_sprites<9>(ptlist, npts, dims, dstimg, sp, kernel_size); break;
+        default: blend_sprites<0>(ptlist, npts, dims, dstimg, sp, kernel_size); break;
+    }
+}
+
+// The original per-pixel splat loop, kept unchanged as the baseline for bench_splat.
+void splat_disks_reference(vec2 const* ptlist, uint32_t npts, u32vec2 dims, uint8_t* dstimg,
+        float alpha, int kernel_size) {
+    const vector<float> sprite = create_sprite(alpha, kernel_size);
 
     // Blend in the points with src-over blending.
     const int32_t width = (int32_t) dims.x;
@@ -159,3 +294,101 @@ void splat_disks(vec2 const* ptlist, uint32_t npts, u32vec2 dims, uint8_t* dstim
         }
     }
 }
+
+// Renders the sprites at "factor" times the resolution of dstimg and box filters the result back
+// down. To keep the working set small, the high resolution image is processed one horizontal
+// band at a time, and each band only sees the points whose sprites overlap it. The existing
+// content of dstimg is used as the background, which lets advect_points keep its fading trails
+// at the output resolution. The kernel size is expressed in high resolution pixels.
+void splat_disks_supersampled(vec2 const* ptlist, uint32_t npts, u32vec2 dims, uint8_t* dstimg,
+        float alpha, int kernel_size, int factor) {
+    constexpr uint32_t kBandHeight = 16;
+    const uint32_t nbands = (dims.y + kBandHeight - 1) / kBandHeight;
+    const int32_t h = kernel_size / 2;
+    const float scale = factor;
+
+    // Sorts the points into bands with a stable counting sort. Sprites that straddle a band
+    // boundary are added to both bands.
+    auto band_range = [&](vec2 pt, int32_t* first, int32_t* last) {
+        const int32_t y = (int32_t) (pt.y * scale);
+        *first = std::max(0, (y - h) / factor) / kBandHeight;
+        *last = std::min(int32_t(nbands) - 1, std::max(0, (y + h) / factor) / int32_t(kBandHeight));
+    };
+    vector<uint32_t> band_offsets(nbands + 1, 0);
+    for (uint32_t i = 0; i < npts; ++i) {
+        int32_t first, last;
+        band_range(ptlist[i], &first, &last);
+        for (int32_t band = first; band <= last; ++band) {
+            ++band_offsets[band + 1];
+        }
+    }
+    for (uint32_t band = 0; band < nbands; ++band) {
+        band_offsets[band + 1] += band_offsets[band];
+    }
+    vector<vec2> binned(band_offsets[nbands]);
+    vector<uint32_t> cursors(band_offsets.begin(), band_offsets.end() - 1);
+    for (uint32_t i = 0; i < npts; ++i) {
+        int32_t first, last;
+        band_range(ptlist[i], &first, &last);
+        for (int32_t band = first; band <= last; ++band) {
+            binned[cursors[band]++] = vec2(ptlist[i].x * scale, (int32_t) (ptlist[i].y * scale));
+        }
+    }
+
+    const uint32_t hiwidth = dims.x * factor;
+    const uint32_t area = factor * factor;
+    vector<uint8_t> strip(hiwidth * kBandHeight * factor);
+    vector<uint16_t> sums(hiwidth);
+
+    for (uint32_t band = 0; band < nbands; ++band) {
+        const uint32_t npoints = band_offsets[band + 1] - band_offsets[band];
+        if (npoints == 0) {
+            continue;
+        }
+        const uint32_t row0 = band * kBandHeight;
+        const uint32_t nrows = std::min(kBandHeight, dims.y - row0);
+
+        // Upsample the background with nearest filtering.
+        for (uint32_t row = 0; row < nrows; ++row) {
+            uint8_t const* src = dstimg + (row0 + row) * dims.x;
+            uint8_t* dst = strip.data() + row * factor * hiwidth;
+            for (uint32_t col = 0; col < dims.x; ++col) {
+                std::fill(dst + col * factor, dst + (col + 1) * factor, src[col]);
+            }
+            for (int i = 1; i < factor; ++i) {
+                std::copy(dst, dst + hiwidth, dst + i * hiwidth);
+            }
+        }
+
+        // Draw the sprites relative to the top of the strip. The Y coordinates were truncated
+        // during binning, so shifting them here does not change which rows they cover.
+        vec2* pts = binned.data() + band_offsets[band];
+        const float yoffset = float(row0 * factor);
+        for (uint32_t i = 0; i < npoints; ++i) {
+            pts[i].y -= yoffset;
+        }
+        splat_disks(pts, npoints, u32vec2(hiwidth, nrows * factor), strip.data(), alpha,
+                kernel_size);
+
+        // Box filter each block of factor x factor pixels. The vertical sum is a simple loop over
+        // contiguous rows, which the compiler vectorizes.
+        for (uint32_t row = 0; row < nrows; ++row) {
+            uint8_t const* src = strip.data() + row * factor * hiwidth;
+            std::fill(sums.begin(), sums.end(), 0);
+            for (int i = 0; i < factor; ++i, src += hiwidth) {
+                for (uint32_t col = 0; col < hiwidth; ++col) {
+                    sums[col] += src[col];
+                }
+            }
+            uint8_t* dst = dstimg + (row0 + row) * dims.x;
+            uint16_t const* sum = sums.data();
+            for (uint32_t col = 0; col < dims.x; ++col, sum += factor) {
+                uint32_t total = 0;
+                for (int i = 0; i < factor; ++i) {
+                    total += sum[i];
+                }
+                dst[col] = (uint8_t) ((total + area / 2) / area);
+            }
+        }
+    }
+}
@@ -422,7 +422,6 @@ int find_blobs(int16_t roi_x, int16_t roi_y, int16_t roi_w, int16_t roi_h,
             
             const uint8_t above_in    = (j > 0) ? *(ptr_in - in_w) : 0;
             const uint8_t below_in    = (j < (roi_h-1)) ? *(ptr_in + in_w) : 0; 
-            const label_t below_label = (j < (roi_h-1)) ? *(ptr_label + roi_w) : -1;
             /* 1. new external countour */
             if((0 == *ptr_label) && (0 == above_in))
             {
@@ -436,8 +435,9 @@ int find_blobs(int16_t roi_x, int16_t roi_y, int16_t roi_w, int16_t roi_h,
                 contour_trace(1, current, i, j, roi_x, roi_y, roi_w, roi_h, roi_in, in_w, *label, &(*blobs+(*count-1))->external);
                 ++current;
             }
-            /* 2. new internal countour */
-            else if((0 == below_in) && (0 == below_label))
+            /* 2. new internal countour, which may start at the same pixel as an external one. */
+            const label_t below_label = (j < (roi_h-1)) ? *(ptr_label + roi_w) : -1;
+            if((0 == below_in) && (0 == below_label))
             {
                 label_t current_label = *ptr_label ? *ptr_label : *(ptr_label-1); // [todo] deserve a bit of explanation
                 
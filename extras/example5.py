@@ -8,8 +8,7 @@ def clumpy(cmd):
     result = system('./clumpy ' + cmd)
     if result: raise Exception("clumpy failed with: " + cmd)
 
-clumpy('generate_simplex 1000x500 1.0 8.0 0 potential.npy')
-clumpy('curl_2d potential.npy velocity.npy')
+clumpy('generate_simplex 1000x500 1.0 8.0 0 velocity.npy mode=curl')
 clumpy('bridson_points 1000x500 5 0 pts.npy')
 clumpy('advect_points pts.npy velocity.npy 30 1 0.95 240 anim.npy')
 Image.fromarray(load("000anim.npy"), "L").point(lambda p: p * 2).show()
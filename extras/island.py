@@ -14,16 +14,20 @@ At Z = 0, Tile Space is equivalent to World Space.
 Note that numpy requires Row,Col integer coordinates, but we internalize those at the lowest level.
 (see sample_pixel)
 
+The island_zoom command is a native port of this script that renders in real time, e.g.:
+
+    clumpy island_zoom 512x512 150 - | ffmpeg -f rawvideo -pix_fmt rgb24 -s 912x512 -r 30 -i - out.mp4
+
 '''
 
-from os import system
+from os import path, system
 from tqdm import tqdm
 from sdl2.ext import clipline
 
 import cairo
 import imageio
 import numpy as np
-import scipy.interpolate as interp
+import tempfile
 
 def vec2(x, y): return np.array([x, y], dtype=np.float)
 def vec3(x, y, z): return np.array([x, y, z], dtype=np.float)
@@ -58,11 +62,10 @@ Viewports = []
 
 def update_view(nlayers = NumLayers):
     resample_image(ViewImage, TileImage, Viewports[-1])
-    seed = Zoom
-    for vp in Viewports[:nlayers]:
-        noise = gradient_noise(Resolution, vp, NoiseFrequency, seed=seed)
+    viewports = Viewports[:nlayers]
+    seeds = range(Zoom, Zoom + len(viewports))
+    for noise in gradient_noise(Resolution, viewports, NoiseFrequency, seeds):
         np.copyto(ViewImage, 2 * (ViewImage + noise))
-        seed = seed + 1
 
 def update_tile():
     global Zoom
@@ -179,15 +182,17 @@ def clumpy(cmd):
     result = system('./clumpy ' + cmd)
     if result: raise Exception("clumpy failed with: " + cmd)
 
-def gradient_noise(dims, viewport, frequency, seed):
-    (left, top), (right, bottom) = 2 * (viewport - 0.5)
-    args = "{}x{} '{},{},{},{}' {} {}".format(
-        dims[0], dims[1],
-        left, -bottom, right, -top,
-        frequency, seed)
-    clumpy("gradient_noise " + args)
-    noise = np.load('gradient_noise.npy')
-    return noise
+# Renders all layers in a single clumpy invocation and returns a stack of images.
+def gradient_noise(dims, viewports, frequency, seeds):
+    args = "{}x{}".format(int(dims[0]), int(dims[1]))
+    for viewport, seed in zip(viewports, seeds):
+        (left, top), (right, bottom) = 2 * (viewport - 0.5)
+        args += " '{},{},{},{}' {} {}".format(left, -bottom, right, -top, frequency, seed)
+    with tempfile.TemporaryDirectory() as tmpdir:
+        output = path.join(tmpdir, 'noise.npy')
+        clumpy("gradient_noise {} output={}".format(args, output))
+        noise = np.load(output)
+    return noise.reshape(-1, int(dims[1]), int(dims[0]))
 
 def sample_pixel(image_array, x, y):
     rows, cols = image_array.shape
@@ -232,15 +237,15 @@ def create_basetile(width, height):
 
 def resample_image(dst, src, viewport):
     height, width = dst.shape
-    domain = [np.linspace(0, 1, num) for num in (width, height)]
     [(left, top), (right, bottom)] = viewport
-    vrange = np.linspace(left, right, num=width)
-    urange = np.linspace(top, bottom, num=height)
-    f = interp.interp1d(domain[0], src, kind='linear', fill_value='extrapolate')
-    temp = f(vrange)
-    f = interp.interp1d(domain[1], temp.T, kind='linear', fill_value='extrapolate')
-    newimg = f(urange).T
-    np.copyto(dst, newimg)
+    with tempfile.TemporaryDirectory() as tmpdir:
+        src_file = path.join(tmpdir, 'src.npy')
+        dst_file = path.join(tmpdir, 'dst.npy')
+        np.save(src_file, np.float32(src))
+        args = "{} '{},{},{},{}' {}x{} bilinear {}".format(
+            src_file, left, top, right, bottom, width, height, dst_file)
+        clumpy("resample " + args)
+        np.copyto(dst, np.load(dst_file))
 
 def create_viewports():
     global Viewports